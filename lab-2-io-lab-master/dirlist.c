@@ -0,0 +1,235 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief compact directory listings read with getdents64
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+// Directory listings
+// ==================
+// readdir() returns one 280-byte struct dirent per call from a small internal buffer. Here, the
+// entries are read with the getdents64 system call into a DL_BUFSIZE buffer (one per thread), so
+// a directory with a few thousand entries takes a single system call. Only the inode number, the
+// type, and the location of the name are kept per entry (16 bytes); the names are appended to one
+// contiguous arena. Sorting permutes a 4-byte index per entry.
+//
+// For unsorted output (-U), a directory stream returns one entry at a time from its own
+// DS_BUFSIZE buffer, so memory depends on the depth of the tree, not on the size of a directory.
+//
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "dirlist.h"
+
+
+/// @brief directory entry as returned by getdents64
+struct linux_dirent64 {
+  uint64_t       d_ino;       ///< inode number
+  int64_t        d_off;       ///< offset of next entry
+  unsigned short d_reclen;    ///< length of this record
+  unsigned char  d_type;      ///< file type
+  char           d_name[];    ///< NUL-terminated name
+};
+
+static __thread char *dbuf = NULL;      ///< getdents64 buffer of the calling thread
+
+
+void dl_init(struct dirlist *dl)
+{
+  memset(dl, 0, sizeof(*dl));
+}
+
+void dl_free(struct dirlist *dl)
+{
+  free(dl->ent);
+  free(dl->idx);
+  free(dl->names);
+  dl_init(dl);
+}
+
+/// @brief append an entry to @a dl
+///
+/// @retval 0 on success
+/// @retval -1 if out of memory
+static int dl_append(struct dirlist *dl, uint64_t ino, unsigned char type, const char *name,
+                     size_t len)
+{
+  if (dl->n == dl->max) {
+    unsigned int nmax = dl->max ? 2*dl->max : 256;
+    struct dentry *nent = realloc(dl->ent, nmax * sizeof(struct dentry));
+    if (nent == NULL) return -1;
+    dl->ent = nent;
+    dl->max = nmax;
+  }
+
+  if (dl->nlen + len + 1 > dl->nmax) {
+    size_t nmax = dl->nmax ? 2*dl->nmax : 4096;
+    while (dl->nlen + len + 1 > nmax) nmax *= 2;
+    char *nnames = realloc(dl->names, nmax);
+    if (nnames == NULL) return -1;
+    dl->names = nnames;
+    dl->nmax = nmax;
+  }
+
+  struct dentry *e = &dl->ent[dl->n++];
+  e->ino  = ino;
+  e->name = dl->nlen;
+  e->len  = len;
+  e->type = type;
+
+  memcpy(dl->names + dl->nlen, name, len + 1);
+  dl->nlen += len + 1;
+
+  return 0;
+}
+
+/// @brief read the entries of directory @a fd into @a dl. If @a count is not NULL, the entries
+///        are counted by type in @a count and only directories are added to @a dl. With
+///        @a limit > 0, reading stops as soon as the listing uses more than @a limit bytes.
+///
+/// @retval 0 if the directory has been read completely
+/// @retval 1 if the limit has been reached
+/// @retval -1 on error
+static int dl_fill(struct dirlist *dl, int fd, uint64_t *count, size_t limit)
+{
+  dl->n = 0;
+  dl->nlen = 0;
+
+  if ((dbuf == NULL) && ((dbuf = malloc(DL_BUFSIZE)) == NULL)) return -1;
+
+  for (;;) {
+    long nread = syscall(SYS_getdents64, fd, dbuf, DL_BUFSIZE);
+    if (nread < 0) return -1;
+    if (nread == 0) break;
+
+    for (long pos = 0; pos < nread; ) {
+      struct linux_dirent64 *d = (struct linux_dirent64*)(dbuf + pos);
+      const char *name = d->d_name;
+      pos += d->d_reclen;
+
+      // skip '.' and '..'
+      if ((name[0] == '.') && ((name[1] == '\0') || ((name[1] == '.') && (name[2] == '\0')))) {
+        continue;
+      }
+
+      if (count != NULL) {
+        count[d->d_type & 0xf]++;
+        if (d->d_type != DT_DIR) continue;
+      }
+
+      if (dl_append(dl, d->d_ino, d->d_type, name, strlen(name)) < 0) {
+        errno = ENOMEM;
+        return -1;
+      }
+    }
+
+    if ((limit > 0) && (dl_size(dl) > limit)) return 1;
+  }
+
+  return 0;
+}
+
+int dl_read(struct dirlist *dl, int fd)
+{
+  return dl_fill(dl, fd, NULL, 0);
+}
+
+int dl_read_limit(struct dirlist *dl, int fd, size_t limit)
+{
+  return dl_fill(dl, fd, NULL, limit);
+}
+
+int dl_scan(struct dirlist *dl, int fd, uint64_t count[16])
+{
+  return dl_fill(dl, fd, count, 0);
+}
+
+int ds_open(struct dirstream *ds, int fd)
+{
+  ds->fd = fd;
+  ds->len = ds->pos = 0;
+  ds->buf = malloc(DS_BUFSIZE);
+
+  return ds->buf != NULL ? 0 : -1;
+}
+
+int ds_next(struct dirstream *ds, struct dsent *e)
+{
+  for (;;) {
+    if (ds->pos >= ds->len) {
+      ds->len = syscall(SYS_getdents64, ds->fd, ds->buf, DS_BUFSIZE);
+      ds->pos = 0;
+      if (ds->len <= 0) return ds->len < 0 ? -1 : 0;
+    }
+
+    struct linux_dirent64 *d = (struct linux_dirent64*)(ds->buf + ds->pos);
+    const char *name = d->d_name;
+    ds->pos += d->d_reclen;
+
+    // skip '.' and '..'
+    if ((name[0] == '.') && ((name[1] == '\0') || ((name[1] == '.') && (name[2] == '\0')))) {
+      continue;
+    }
+
+    e->ino  = d->d_ino;
+    e->type = d->d_type;
+    e->len  = strlen(name);
+    memcpy(e->name, name, e->len + 1);
+
+    return 1;
+  }
+}
+
+void ds_close(struct dirstream *ds)
+{
+  free(ds->buf);
+  ds->buf = NULL;
+}
+
+int dirent_order(unsigned char ta, const char *a, unsigned char tb, const char *b)
+{
+  // if one of the entries is a directory, it comes first
+  if (ta != tb) {
+    if (ta == DT_DIR) return -1;
+    if (tb == DT_DIR) return 1;
+  }
+
+  // otherwise sort by name
+  return strcmp(a, b);
+}
+
+int dirent_compare(const struct dirlist *dl, const struct dentry *a, const struct dentry *b)
+{
+  return dirent_order(a->type, dl_name(dl, a), b->type, dl_name(dl, b));
+}
+
+/// @brief qsort_r comparator for entry indices
+static int idx_compare(const void *a, const void *b, void *arg)
+{
+  const struct dirlist *dl = arg;
+
+  return dirent_compare(dl, &dl->ent[*(const uint32_t*)a], &dl->ent[*(const uint32_t*)b]);
+}
+
+void dl_sort(struct dirlist *dl)
+{
+  free(dl->idx);
+  dl->idx = malloc((dl->n ? dl->n : 1) * sizeof(uint32_t));
+  if (dl->idx == NULL) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (unsigned int i = 0; i < dl->n; i++) dl->idx[i] = i;
+
+  qsort_r(dl->idx, dl->n, sizeof(uint32_t), idx_compare, dl);
+}
@@ -0,0 +1,154 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief compact directory listings read with getdents64
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+#ifndef __DIRLIST_H__
+#define __DIRLIST_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// @brief size of the getdents64 buffer
+#define DL_BUFSIZE (256*1024)
+
+/// @brief size of the getdents64 buffer of a directory stream
+#define DS_BUFSIZE (32*1024)
+
+/// @brief compact directory entry (16 bytes). The name is stored in the listing's name arena.
+struct dentry {
+  uint64_t ino;               ///< inode number
+  uint32_t name;              ///< offset of the (NUL-terminated) name in the name arena
+  uint16_t len;               ///< length of the name
+  uint8_t  type;              ///< file type (DT_*)
+};
+
+/// @brief directory listing
+struct dirlist {
+  struct dentry *ent;         ///< entries in the order returned by the kernel
+  unsigned int  n;            ///< number of entries
+  unsigned int  max;          ///< capacity of ent[]
+  uint32_t      *idx;         ///< sorted order of the entries (after dl_sort())
+  char          *names;       ///< name arena
+  size_t        nlen;         ///< bytes used in the name arena
+  size_t        nmax;         ///< capacity of the name arena
+};
+
+/// @brief directory stream: reads a directory incrementally (for unsorted output)
+struct dirstream {
+  int   fd;                   ///< open directory
+  char  *buf;                 ///< getdents64 buffer (DS_BUFSIZE bytes)
+  long  len;                  ///< number of bytes in buf
+  long  pos;                  ///< position of the next record in buf
+};
+
+/// @brief entry returned by a directory stream (a copy that stays valid while the stream is read)
+struct dsent {
+  uint64_t ino;               ///< inode number
+  uint16_t len;               ///< length of the name
+  uint8_t  type;              ///< file type (DT_*)
+  char     name[256];         ///< NUL-terminated name
+};
+
+/// @brief initialize an empty listing
+void dl_init(struct dirlist *dl);
+
+/// @brief free the memory of listing @a dl
+void dl_free(struct dirlist *dl);
+
+/// @brief read all entries of the open directory @a fd into @a dl, replacing its previous content.
+///        The entries '.' and '..' are skipped.
+///
+/// @param dl listing
+/// @param fd open directory
+/// @retval 0 on success
+/// @retval -1 on error (errno is set); the entries read so far are kept
+int dl_read(struct dirlist *dl, int fd);
+
+/// @brief like dl_read(), but stop reading once the listing uses more than @a limit bytes
+///        (see dl_size()). Reading can be continued with further calls, each of which replaces
+///        the content of @a dl with the next part of the directory.
+///
+/// @param dl listing
+/// @param fd open directory
+/// @param limit memory limit in bytes
+/// @retval 0 if the rest of the directory has been read
+/// @retval 1 if the limit has been reached and more entries may follow
+/// @retval -1 on error (errno is set)
+int dl_read_limit(struct dirlist *dl, int fd, size_t limit);
+
+/// @brief scan the open directory @a fd: count its entries by type and read only the
+///        subdirectories into @a dl, replacing its previous content. '.' and '..' are skipped.
+///
+/// @param dl listing
+/// @param fd open directory
+/// @param count array indexed by file type (DT_*); the counts are added to it
+/// @retval 0 on success
+/// @retval -1 on error (errno is set); the entries read so far are kept and counted
+int dl_scan(struct dirlist *dl, int fd, uint64_t count[16]);
+
+/// @brief sort the entries of @a dl by name, directories first (see dirent_compare()).
+///        The entries are not moved; dl->idx holds the sorted order.
+void dl_sort(struct dirlist *dl);
+
+/// @brief open a stream on the open directory @a fd
+///
+/// @param ds directory stream
+/// @param fd open directory
+/// @retval 0 on success
+/// @retval -1 if out of memory
+int ds_open(struct dirstream *ds, int fd);
+
+/// @brief read the next entry of stream @a ds into @a e. '.' and '..' are skipped.
+///
+/// @param ds directory stream
+/// @param e receives the entry
+/// @retval 1 if an entry was read
+/// @retval 0 at the end of the directory
+/// @retval -1 on error (errno is set)
+int ds_next(struct dirstream *ds, struct dsent *e);
+
+/// @brief close stream @a ds (the directory itself is not closed)
+void ds_close(struct dirstream *ds);
+
+/// @brief compare two entries given by type and name in the order of dl_sort(): directories
+///        first, then by name (strcmp)
+///
+/// @param ta type of first entry
+/// @param a name of first entry
+/// @param tb type of second entry
+/// @param b name of second entry
+/// @retval <0, 0, >0 if the first entry sorts before, equal to, or after the second one
+int dirent_order(unsigned char ta, const char *a, unsigned char tb, const char *b);
+
+/// @brief compare two entries of @a dl in the order of dl_sort()
+///
+/// @param dl listing
+/// @param a first entry
+/// @param b second entry
+/// @retval <0, 0, >0 if @a a sorts before, equal to, or after @a b
+int dirent_compare(const struct dirlist *dl, const struct dentry *a, const struct dentry *b);
+
+/// @brief name of entry @a e of listing @a dl
+static inline const char *dl_name(const struct dirlist *dl, const struct dentry *e)
+{
+  return dl->names + e->name;
+}
+
+/// @brief memory used by the entries of @a dl (entry records, sort index, and names)
+static inline size_t dl_size(const struct dirlist *dl)
+{
+  return (size_t)dl->n * (sizeof(struct dentry) + sizeof(uint32_t)) + dl->nlen;
+}
+
+/// @brief @a i-th entry of @a dl in sorted order
+static inline const struct dentry *dl_sorted(const struct dirlist *dl, unsigned int i)
+{
+  return &dl->ent[dl->idx[i]];
+}
+
+#endif // __DIRLIST_H__
@@ -15,18 +15,38 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdarg.h>
 #include <assert.h>
-#include <grp.h>
-#include <pwd.h>
+#include <pthread.h>
+#include <fnmatch.h>
+
+#include "dirlist.h"
+#include "dups.h"
+#include "extsort.h"
+#include "idcache.h"
+#include "index.h"
+#include "inoset.h"
+#include "meta.h"
+#include "outbuf.h"
+#include "pool.h"
+#include "snapshot.h"
 
 #define MAX_DIR 64            ///< maximum number of directories supported
+#define MAX_EXCLUDE 64        ///< maximum number of --exclude patterns
 
 /// @brief output control flags
 #define F_TREE      0x1       ///< enable tree view
 #define F_SUMMARY   0x2       ///< enable summary
 #define F_VERBOSE   0x4       ///< turn on verbose mode
+#define F_UNSORTED  0x8       ///< print entries in directory order while reading (streaming)
+#define F_UNIQUE    0x10      ///< count the size of hard-linked files once
+#define F_XDEV      0x20      ///< do not descend into directories on other file systems
+#define F_DUPS      0x40      ///< find duplicate files instead of printing the tree
+#define F_DIRSIZE   0x80      ///< print the cumulative size of each directory on its line
+#define F_TOP       0x100     ///< report the largest directories and files
+#define F_META      (F_VERBOSE | F_DIRSIZE | F_TOP)   ///< flags that need the entries' metadata
 
 /// @brief struct holding the summary
 struct summary {
@@ -38,8 +58,95 @@ struct summary {
 
   unsigned long long size;    ///< total size (in bytes)
   unsigned long long blocks;  ///< total number of blocks (512 byte blocks)
+  unsigned long long hlinks;  ///< names of files already counted under another name (-u)
+  unsigned int excluded;      ///< entries skipped by --exclude (not counted above)
+  unsigned int pruned;        ///< directories not entered because of -L or -x
 };
 
+/// @brief cumulative size of the entries below a directory (-d, --top)
+struct agg {
+  unsigned long long size;    ///< total size (in bytes)
+  unsigned long long blocks;  ///< total number of blocks (512 byte blocks)
+  unsigned long long files;   ///< number of regular files
+};
+
+/// @brief no aggregate field (see aggField())
+#define NOAGG ((size_t)-1)
+
+
+// Parallel traversal
+// ==================
+// With -j N, every directory is processed by a job on a work-stealing pool of N threads (see
+// pool.c). A job lists and sorts its directory and renders the lines of its entries into a
+// private memory stream. For each subdirectory, it records the position in the stream where the
+// subdirectory's output belongs and submits a child job instead of recursing.
+//
+// The main thread emits the output in order: it writes a job's stream up to the position of the
+// first child, waits for that child and emits it recursively, continues with the next part of
+// the stream, and so on. The output is therefore identical to a sequential run and is printed
+// as soon as the subtrees in front of it are complete.
+//
+// Summaries are counted per worker thread and added up after the tree has been emitted.
+
+/// @brief subdirectory of a job: its output belongs at position @a pos of the parent's output
+struct child {
+  size_t pos;                 ///< position in parent output
+  struct job *job;            ///< job processing the subdirectory
+};
+
+/// @brief open directory shared by the jobs of its subdirectories (reference counted)
+struct dirref {
+  int fd;                     ///< directory file descriptor
+  unsigned int refcnt;        ///< number of references (the owner and not yet started children)
+};
+
+/// @brief job processing one directory (parallel mode)
+struct job {
+  struct dirref *parent;      ///< parent directory, NULL for a root directory
+  char *dn;                   ///< directory name relative to parent (root: path)
+  char *pstr;                 ///< prefix string
+  unsigned int flags;         ///< output control flags
+  unsigned int level;         ///< depth of the directory below the root directory
+  char *path;                 ///< path of the directory (--top), NULL otherwise
+  size_t aggpos;              ///< aggregate field of the directory's line in the parent's output
+  struct agg agg;             ///< aggregate of the directory (-d, --top; see totalJob())
+
+  struct outbuf *out;         ///< output buffer of the worker (while the job is running)
+  char *buf;                  ///< rendered output (after the job is done)
+  size_t len;                 ///< length of rendered output
+
+  struct child *children;     ///< subdirectories in output order
+  unsigned int nchildren;     ///< number of subdirectories
+  unsigned int maxchildren;   ///< capacity of children[]
+
+  int done;                   ///< job completed
+};
+
+static struct pool *pool = NULL;                          ///< thread pool (parallel mode)
+static struct summary *tstats = NULL;                     ///< per-thread summaries
+static __thread struct outbuf tout;                       ///< output buffer of a worker thread
+static size_t sortmem = 0;                                ///< memory budget per directory (-M)
+static pthread_mutex_t job_mtx = PTHREAD_MUTEX_INITIALIZER; ///< protects job->done
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;  ///< signaled when a job completes
+
+
+// Directory file descriptors
+// ==========================
+// Directories are opened relative to their parent's file descriptor (openat), and entries are
+// inspected with fstatat relative to their directory, so the kernel never resolves more than one
+// path component per call. No path strings are built; the root path is the only one printed.
+// In parallel mode, a directory's descriptor is shared with the jobs of its subdirectories and
+// closed when the last of them has opened its own directory.
+
+/// @brief release reference to @a ref; close the directory when it was the last one
+static void dirref_put(struct dirref *ref)
+{
+  if (__atomic_sub_fetch(&ref->refcnt, 1, __ATOMIC_ACQ_REL) == 0) {
+    close(ref->fd);
+    free(ref);
+  }
+}
+
 
 /// @brief abort the program with EXIT_FAILURE and an optional error message
 ///
@@ -51,216 +158,1297 @@ void panic(const char *msg)
 }
 
 
-/// @brief read next directory entry from open directory 'dir'. Ignores '.' and '..' entries
+/// @brief print the error line "<pstr>`-ERROR: <error message>" for a directory
+///
+/// @param out output buffer
+/// @param pstr prefix string
+/// @param plen length of @a pstr
+/// @param flags output control flags
+/// @param err error number
+static void printError(struct outbuf *out, const char *pstr, size_t plen, unsigned int flags,
+                       int err)
+{
+  ob_put(out, pstr, plen);
+  ob_put(out, flags & F_TREE ? "`-" : "  ", 2);
+  ob_puts(out, "ERROR: ");
+  ob_puts(out, strerror(err));
+  ob_putc(out, '\n');
+}
+
+
+/// @brief print the line of an entry
 ///
-/// @param dir open DIR* stream
-/// @retval entry on success
-/// @retval NULL on error or if there are no more entries
-struct dirent *getNext(DIR *dir)
+/// @param out output buffer
+/// @param pstr prefix string
+/// @param plen length of @a pstr
+/// @param name entry name
+/// @param len length of @a name
+/// @param last the entry is the last one of its directory
+/// @param sb metadata of the entry (verbose mode), NULL otherwise
+/// @param flags output control flags
+static void printEntry(struct outbuf *out, const char *pstr, size_t plen, const char *name,
+                       size_t len, int last, const struct meta *sb, unsigned int flags)
 {
-  struct dirent *next;
-  int ignore;
+  // render the line directly into the output buffer: prefix and name first
+  size_t start = out->len;
+  ob_put(out, pstr, plen);
+  if (flags & F_TREE) ob_put(out, last ? "`-" : "|-", 2);
+  else ob_put(out, "  ", 2);
+  ob_put(out, name, len);
+
+  // file meta-data
+  if (sb != NULL) {
+    size_t llen = out->len - start;
+
+    if (sb->err == 0) {
+      // type
+      char type = S_ISREG(sb->mode) ? ' ' :
+        S_ISDIR(sb->mode) ? 'd' :
+        S_ISCHR(sb->mode) ? 'c' :
+        S_ISBLK(sb->mode) ? 'b' :
+        S_ISLNK(sb->mode) ? 'l' :
+        S_ISFIFO(sb->mode) ? 'f' :
+        S_ISSOCK(sb->mode) ? 's' :
+        '?';
+
+      // make ... if necessary
+      if (llen > 54) {
+        out->len = start + 51;
+        ob_put(out, "...", 3);
+        llen = 54;
+      }
 
-  do {
-    errno = 0;
-    next = readdir(dir);
-    if (errno != 0) perror(NULL);
-    ignore = next && ((strcmp(next->d_name, ".") == 0) || (strcmp(next->d_name, "..") == 0));
-  } while (next && ignore);
+      // "%-54s %8s:%-8s %10ld %8ld %c" with user and group names cached (see idcache.c)
+      ob_pad(out, 54 - llen + 1);
+      ob_right(out, idc_user(sb->uid), 8);
+      ob_putc(out, ':');
+      ob_left(out, idc_group(sb->gid), 8);
+      ob_putc(out, ' ');
+      ob_num(out, sb->size, 10);
+      ob_putc(out, ' ');
+      ob_num(out, sb->blocks, 8);
+      ob_putc(out, ' ');
+      ob_putc(out, type);
+    } else {
+      // "%-54s %s"
+      ob_pad(out, (llen < 54 ? 54 - llen : 0) + 1);
+      ob_puts(out, strerror(sb->err));
+    }
+  }
 
-  return next;
+  ob_putc(out, '\n');
 }
 
 
-/// @brief qsort comparator to sort directory entries. Sorted by name, directories first.
+/// @brief add an entry of type @a type to the summary
 ///
-/// @param a pointer to first entry
-/// @param b pointer to second entry
-/// @retval -1 if a<b
-/// @retval 0  if a==b
-/// @retval 1  if a>b
-static int dirent_compare(const void *a, const void *b)
+/// @param stats pointer to statistics
+/// @param type file type (DT_*)
+/// @param sb metadata of the entry (verbose mode), NULL otherwise
+/// @param flags output control flags (F_*)
+static void countEntry(struct summary *stats, unsigned char type, const struct meta *sb,
+                       unsigned int flags)
 {
-  struct dirent *e1 = (struct dirent*)a;
-  struct dirent *e2 = (struct dirent*)b;
+  switch (type) {
+    case DT_REG: stats->files++; break;
+    case DT_DIR: stats->dirs++; break;
+    case DT_LNK: stats->links++; break;
+    case DT_FIFO: stats->fifos++; break;
+    case DT_SOCK: stats->socks++; break;
+    default: ;
+  }
+
+  if ((sb != NULL) && (sb->err == 0)) {
+    // unique mode: further names of a hard-linked file add no size (see inoset.c)
+    if ((flags & F_UNIQUE) && (sb->nlink > 1) && !S_ISDIR(sb->mode) &&
+        !ino_add(sb->dev, sb->ino)) {
+      stats->hlinks++;
+      return;
+    }
+    stats->size += sb->size;
+    stats->blocks += sb->blocks;
+  }
+}
+
+
+// Pruning
+// =======
+// The filters are applied before a directory is opened, so pruned subtrees cost no I/O:
+// - --exclude GLOB drops every entry whose name matches GLOB (fnmatch) from the output and the
+//   counts; excluded directories are not entered.
+// - -L depth lists entries up to 'depth' levels below a root directory; the directories on the
+//   last level are listed but not entered.
+// - -x does not enter directories on a file system other than that of the root directory.
+// Excluded entries and directories not entered are counted separately in the summary.
+
+static unsigned int maxdepth = 0;                         ///< maximum depth (-L), 0: unlimited
+static const char *exclude[MAX_EXCLUDE];                  ///< exclude patterns (--exclude)
+static int nexclude = 0;                                  ///< number of exclude patterns
+static dev_t rootdev;                                     ///< device of the root directory (-x)
+
 
-  // if one of the entries is a directory, it comes first
-  if (e1->d_type != e2->d_type) {
-    if (e1->d_type == DT_DIR) return -1;
-    if (e2->d_type == DT_DIR) return 1;
+/// @brief check whether entry @a name matches an exclude pattern
+static int excluded(const char *name)
+{
+  for (int i = 0; i < nexclude; i++) {
+    if (fnmatch(exclude[i], name, 0) == 0) return 1;
   }
 
-  // otherwise sorty by name
-  return strcmp(e1->d_name, e2->d_name);
+  return 0;
 }
 
+/// @brief decide whether to enter subdirectory @a name of directory @a dfd. Directories not
+///        entered are counted in @a stats.
+///
+/// @param dfd open parent directory
+/// @param name name of the subdirectory
+/// @param sb metadata of the subdirectory (verbose mode), NULL otherwise
+/// @param level depth of the subdirectory below the root directory (entries of the root: 1)
+/// @param stats pointer to statistics
+/// @param flags output control flags (F_*)
+/// @retval 1 if the subdirectory is to be entered
+/// @retval 0 otherwise
+static int enterDir(int dfd, const char *name, const struct meta *sb, unsigned int level,
+                    struct summary *stats, unsigned int flags)
+{
+  if ((maxdepth > 0) && (level >= maxdepth)) {
+    stats->pruned++;
+    return 0;
+  }
 
-/// @brief recursively process directory @a dn and print its tree
+  if (flags & F_XDEV) {
+    struct stat dsb;
+    dev_t dev;
+
+    if ((sb != NULL) && (sb->err == 0)) dev = sb->dev;
+    else if (fstatat(dfd, name, &dsb, AT_SYMLINK_NOFOLLOW) == 0) dev = dsb.st_dev;
+    else return 1;    // let openat report the error
+
+    if (dev != rootdev) {
+      stats->pruned++;
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+static struct job *newJob(struct job *parent, struct dirref *dir, char *dn, char *pstr,
+                          char *path, size_t aggpos, unsigned int flags);
+
+
+// Traversal
+// =========
+// The tree is traversed iteratively with an explicit stack of directory frames, so the depth of
+// a tree is limited by memory and open file descriptors rather than by the C stack. The prefix
+// of the current level is kept in a single buffer: descending into a directory appends "| " or
+// " ", returning from it truncates the buffer again, which keeps the cost per level constant.
+// Frames, stack, and prefix buffer belong to the calling thread and are reused.
+//
+// A frame delivers the entries of its directory in output order from one of three sources:
+// - a sorted listing in memory (the default; possibly taken from the index),
+// - a directory stream (-U), or
+// - an external merge sort (-M, for directories that exceed the memory budget).
+// The last two deliver one entry at a time; a one-entry lookahead tells whether an entry is the
+// last one of its directory. Entries matching an exclude pattern are skipped by the source, so
+// the last entry delivered is marked as such.
+
+/// @brief entry sources of a frame
+enum { SRC_LIST, SRC_STREAM, SRC_EXTERNAL };
+
+/// @brief directory being traversed
+struct frame {
+  int fd;                     ///< open directory
+  int src;                    ///< entry source (SRC_*)
+  size_t plen;                ///< length of the prefix of the directory's entries
+  struct summary *stats;      ///< statistics (excluded entries)
+
+  struct dirlist dl;          ///< SRC_LIST: sorted listing
+  const struct meta *meta;    ///< SRC_LIST: metadata of the entries (verbose mode)
+  struct meta *mbuf;          ///< SRC_LIST: metadata allocated by this frame
+  int cached;                 ///< SRC_LIST: listing points into the index
+  unsigned int pos;           ///< SRC_LIST: next entry in sorted order
+
+  struct dirstream ds;        ///< SRC_STREAM: directory stream
+  struct extsort es;          ///< SRC_EXTERNAL: external sort
+  struct dsent ent[2];        ///< current and lookahead entry
+  int cur;                    ///< index of the lookahead entry in ent[]
+  int more;                   ///< result of reading the lookahead entry
+  struct meta m;              ///< metadata of the current entry (verbose mode)
+
+  struct agg agg;             ///< aggregate of the entries so far (-d, --top)
+  size_t aggpos;              ///< aggregate field of the directory's line, NOAGG if none
+  size_t dlen;                ///< length of the directory's path in tpath (--top)
+};
+
+/// @brief entry delivered by a frame
+struct entry {
+  const char *name;           ///< name
+  size_t len;                 ///< length of name
+  unsigned char type;         ///< file type (DT_*)
+  int last;                   ///< last entry of the directory
+  const struct meta *sb;      ///< metadata (verbose mode, -d, --top), NULL otherwise
+};
+
+/// @brief growable prefix string
+struct prefix {
+  char *buf;                  ///< NUL-terminated prefix
+  size_t len;                 ///< length of prefix
+  size_t max;                 ///< capacity of buf
+};
+
+static __thread struct frame **frames = NULL;             ///< frame stack of the calling thread
+static __thread unsigned int maxframes = 0;               ///< capacity of frames[]
+static __thread struct prefix tprefix;                    ///< prefix buffer of the calling thread
+
+
+/// @brief append @a n characters at @a s to prefix @a p
+static void prefix_add(struct prefix *p, const char *s, size_t n)
+{
+  if (p->len + n + 1 > p->max) {
+    size_t max = p->max ? 2*p->max : 256;
+    while (p->len + n + 1 > max) max *= 2;
+    p->buf = realloc(p->buf, max);
+    if (p->buf == NULL) panic("Out of memory.");
+    p->max = max;
+  }
+  memcpy(p->buf + p->len, s, n);
+  p->len += n;
+  p->buf[p->len] = '\0';
+}
+
+/// @brief truncate prefix @a p to @a len characters
+static inline void prefix_cut(struct prefix *p, size_t len)
+{
+  p->len = len;
+  p->buf[len] = '\0';
+}
+
+/// @brief read the next entry of the source of frame @a f into @a e (SRC_STREAM, SRC_EXTERNAL)
+static int srcNext(struct frame *f, struct dsent *e)
+{
+  for (;;) {
+    int res = f->src == SRC_STREAM ? ds_next(&f->ds, e) : es_next(&f->es, e);
+    if ((res <= 0) || (nexclude == 0) || !excluded(e->name)) return res;
+    f->stats->excluded++;
+  }
+}
+
+/// @brief advance frame @a f to the next entry of its listing that is not excluded (SRC_LIST)
+static void skipExcluded(struct frame *f)
+{
+  while ((nexclude > 0) && (f->pos < f->dl.n) &&
+         excluded(dl_name(&f->dl, dl_sorted(&f->dl, f->pos)))) {
+    f->stats->excluded++;
+    f->pos++;
+  }
+}
+
+/// @brief read the first entry of a streaming source into the lookahead
 ///
-/// @param dn absolute or relative path string
-/// @param pstr prefix string printed in front of each entry
+/// @retval 0 if the directory has entries
+/// @retval -1 if it is empty or cannot be read
+static int startLookahead(struct frame *f)
+{
+  f->cur = 0;
+  f->more = srcNext(f, &f->ent[0]);
+  if (f->more < 0) perror(NULL);
+
+  return f->more > 0 ? 0 : -1;
+}
+
+/// @brief release the entry source of frame @a f (the directory is not closed)
+static void closeFrame(struct frame *f)
+{
+  switch (f->src) {
+    case SRC_LIST:
+      free(f->mbuf);
+      if (!f->cached) dl_free(&f->dl);
+      break;
+    case SRC_STREAM:   ds_close(&f->ds); break;
+    case SRC_EXTERNAL: es_free(&f->es);  break;
+  }
+}
+
+/// @brief open directory @a dn and prepare frame @a f to deliver its entries. Errors are
+///        printed as the directory's only entry.
+///
+/// @param f frame
+/// @param dfd file descriptor of the parent directory or AT_FDCWD
+/// @param dn directory name relative to @a dfd (or absolute path)
+/// @param pre prefix of the directory's entries
 /// @param stats pointer to statistics
 /// @param flags output control flags (F_*)
-void processDir(const char *dn, const char *pstr, struct summary *stats, unsigned int flags)
+/// @param out output buffer
+/// @retval 0 if the frame has entries to deliver
+/// @retval -1 if the directory is empty or cannot be read (nothing to release)
+static int openFrame(struct frame *f, int dfd, const char *dn, const struct prefix *pre,
+                     struct summary *stats, unsigned int flags, struct outbuf *out)
 {
-  // TODO
-  unsigned int nentry, nmax;
-  struct dirent *entry, *entries;
+  f->plen = pre->len;
+  f->stats = stats;
 
   // open directory
-  DIR *directory  = opendir(dn);
-  if (directory == NULL) {
-  printf("%s%sERROR: %s\n", pstr, flags & F_TREE ? "`-" : "  ", strerror(errno));
-  return;
+  f->fd = openat(dfd, dn, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (f->fd < 0) {
+    printError(out, pre->buf, pre->len, flags, errno);
+    return -1;
+  }
+
+  // unsorted: stream the directory
+  if (flags & F_UNSORTED) {
+    f->src = SRC_STREAM;
+    if (ds_open(&f->ds, f->fd) < 0) {
+      printError(out, pre->buf, pre->len, flags, ENOMEM);
+      close(f->fd);
+      return -1;
+    }
+    if (startLookahead(f) < 0) {
+      ds_close(&f->ds);
+      close(f->fd);
+      return -1;
+    }
+    return 0;
+  }
+
+  // unchanged directory: take listing and metadata from the index (see index.c)
+  struct stat dsb;
+  int indexed = 0, complete = 1;
+
+  f->src = SRC_LIST;
+  f->meta = NULL;
+  f->mbuf = NULL;
+  f->cached = 0;
+  f->pos = 0;
+
+  if (idx_active() && (fstat(f->fd, &dsb) == 0)) {
+    indexed = 1;
+    f->cached = idx_lookup(&dsb, flags & F_META, &f->dl, &f->meta, NULL);
   }
 
   // read directory
-  nentry = 0;
-  nmax = 0;
-  entries = NULL;
+  if (!f->cached) {
+    dl_init(&f->dl);
+    int res = sortmem > 0 ? dl_read_limit(&f->dl, f->fd, sortmem) : dl_read(&f->dl, f->fd);
+    if (res < 0) {
+      if (errno == ENOMEM) {
+        printError(out, pre->buf, pre->len, flags, errno);
+        dl_free(&f->dl);
+        close(f->fd);
+        return -1;
+      }
+      // other errors: report and list the entries read so far
+      perror(NULL);
+      complete = 0;
+    } else if (res > 0) {
+      // directory exceeds the memory budget: sort it externally (not stored in the index)
+      f->src = SRC_EXTERNAL;
+      res = es_sort(&f->es, &f->dl, f->fd, sortmem);
+      dl_free(&f->dl);
+      if (res < 0) {
+        printError(out, pre->buf, pre->len, flags, errno);
+        es_free(&f->es);
+        close(f->fd);
+        return -1;
+      }
+      if (startLookahead(f) < 0) {
+        es_free(&f->es);
+        close(f->fd);
+        return -1;
+      }
+      return 0;
+    }
+  }
 
-  while ((entry = getNext(directory)) != NULL ){
-     if (nentry == nmax) {
-      nmax = nmax + 1024;
+  if (f->dl.n == 0) {
+    if (indexed && complete) idx_store(&dsb, &f->dl, NULL);
+    if (!f->cached) dl_free(&f->dl);
+    close(f->fd);
+    return -1;
+  }
 
-    struct dirent *nentries = realloc(entries, sizeof(struct dirent)*nmax);
-    if (nentries == NULL) {
-      printf("%s%sERROR: %s\n", pstr, flags & F_TREE ? "`-" : "  ", strerror(errno));
-      free(entries);
-      closedir(directory);
-      return ;
+  if (!f->cached) {
+    // sort entries
+    //
+    dl_sort(&f->dl);
+
+    // retrieve metadata of all entries at once (see meta.c)
+    if (flags & F_META) {
+      f->mbuf = malloc(f->dl.n * sizeof(struct meta));
+      if (f->mbuf == NULL) panic("Out of memory.");
+      meta_fetch(f->fd, &f->dl, f->mbuf);
+      f->meta = f->mbuf;
     }
-  entries = nentries;
+  }
+
+  if (indexed && complete) idx_store(&dsb, &f->dl, f->meta);
 
+  skipExcluded(f);
+  if (f->pos == f->dl.n) {
+    closeFrame(f);
+    close(f->fd);
+    return -1;
   }
-     entries[nentry] = *entry;
-     nentry++;
+
+  return 0;
+}
+
+/// @brief get the next entry of frame @a f
+///
+/// @param f frame
+/// @param flags output control flags (F_*)
+/// @param e receives the entry; valid until the next call for @a f
+/// @retval 1 if an entry was returned
+/// @retval 0 if all entries have been delivered
+static int nextEntry(struct frame *f, unsigned int flags, struct entry *e)
+{
+  if (f->src == SRC_LIST) {
+    if (f->pos >= f->dl.n) return 0;
+
+    const struct dentry *d = dl_sorted(&f->dl, f->pos);
+    e->name = dl_name(&f->dl, d);
+    e->len  = d->len;
+    e->type = d->type;
+    e->sb   = flags & F_META ? &f->meta[f->dl.idx[f->pos]] : NULL;
+    f->pos++;
+    skipExcluded(f);
+    e->last = f->pos == f->dl.n;
+
+    return 1;
   }
 
-  closedir(directory);
+  if (f->more <= 0) return 0;
+
+  const struct dsent *d = &f->ent[f->cur];
+  f->cur ^= 1;
+  f->more = srcNext(f, &f->ent[f->cur]);
+  // report read errors; the entries read so far are listed
+  if (f->more < 0) perror(NULL);
+
+  e->name = d->name;
+  e->len  = d->len;
+  e->type = d->type;
+  e->last = f->more <= 0;
+  e->sb   = NULL;
+  if (flags & F_META) {
+    meta_stat(f->fd, d->name, &f->m);
+    e->sb = &f->m;
+  }
 
-  if (nentry == 0) return;
+  return 1;
+}
 
-  // sort entries
-  //
-  qsort(entries, nentry, sizeof(entries[0]), dirent_compare);
 
- //process entries
-  for (unsigned int pos=0; pos<nentry; pos++){
-    struct dirent *this = &entries[pos];
-    struct stat sb;
-    int stat_valid = 0;
-    char *fn, *out, *tmp;
+/// @brief return frame @a depth of the calling thread's stack, growing the stack if needed
+static struct frame *pushFrame(unsigned int depth)
+{
+  if (depth == maxframes) {
+    unsigned int max = maxframes ? 2*maxframes : 16;
+
+    frames = realloc(frames, max*sizeof(struct frame*));
+    if (frames == NULL) panic("Out of memory.");
+    for (unsigned int i = maxframes; i < max; i++) {
+      frames[i] = malloc(sizeof(struct frame));
+      if (frames[i] == NULL) panic("Out of memory.");
+    }
+    maxframes = max;
+  }
 
-    if (asprintf(&fn, "%s%s", dn, this->d_name) == -1) panic("Out of memory");
+  return frames[depth];
+}
 
-    //make output string
-    if (flags & F_TREE) {
-      if (asprintf(&out, "%s%s", pstr, pos<nentry-1 ? "|-" : "`-") == -1 ) panic("Out of memory.");
-    } else {
-      if (asprintf(&out, "%s  ", pstr) == -1 ) panic("Out of memory.");
-    }
-
-    if (asprintf(&tmp, "%s%s", out, this->d_name) == -1) panic("Out of memory.");
-    free(out);
-    out = tmp;
-
-      // file meta-data
-      if (flags & F_VERBOSE) {
-        stat_valid = lstat(fn, &sb) == 0;
-       //printf("\nHi! fn is %s and &sb is %p\n", fn, &sb);
-
-        if(stat_valid) {
-          // type
-          char type = S_ISREG(sb.st_mode) ? ' ' :
-            S_ISDIR(sb.st_mode) ? 'd' :
-            S_ISCHR(sb.st_mode) ? 'c' :
-            S_ISBLK(sb.st_mode) ? 'b' :
-            S_ISLNK(sb.st_mode) ? 'l' :
-            S_ISFIFO(sb.st_mode) ? 'f' :
-            S_ISSOCK(sb.st_mode) ? 's' :
-            '?';
-
-          // user name
-          char *ustr = NULL;
-          struct passwd *pwd = getpwuid(sb.st_uid);
-          if (pwd != NULL) ustr = strdup(pwd->pw_name);
-          else {
-            if (asprintf(&ustr, "%d", sb.st_uid) == -1) panic("Out of memory.");
-          }
-
-          //group name
-          char *gstr = NULL;
-          struct group *grp = getgrgid(sb.st_gid);
-          if (grp != NULL) gstr = strdup(grp->gr_name);
-          else {
-            if (asprintf(&gstr, "%d", sb.st_gid) == -1) panic("Out of memory.");
-          }
-
-          // make ... if necessary
-          char fstr[55];
-          fstr[54] = '\0';
-          strncpy(fstr, out, sizeof(fstr));
-          if (fstr[54] != '\0') {
-            fstr[51] = '.';
-            fstr[52] = '.';
-            fstr[53] = '.';
-            fstr[54] = '\0';
-          }
-
-          // make it together
-          if (asprintf(&tmp, "%-54s %8s:%-8s %10ld %8ld %c", fstr, ustr, gstr, sb.st_size, sb.st_blocks, type) == -1) {
-            panic("Out of memory.");
-          }
-          free(out);
-          out = tmp;
-
-          free(ustr);
-          free(gstr);
-        } else {
-          if (asprintf(&tmp, "%-54s %s", out, strerror(errno)) == -1) panic("Out of memory.");
-          free(out);
-          out = tmp;
-        
-      }
+
+// Directory aggregates
+// ====================
+// With -d, the line of every directory that is entered shows the total size, blocks, and number
+// of regular files below it. The totals are known only after the subtree has been traversed,
+// while the line is printed before it. The line therefore ends in a blank field of fixed width
+// (aggField()) that is filled in when the directory's frame is popped; the frame's totals are
+// then added to those of its parent (post-order). The output of a tree is kept in memory until
+// the tree is complete.
+//
+// In parallel mode, every job sums up its own entries. Once all jobs of a tree are done, the
+// totals are merged from the leaves up (totalJob()) and the fields in the jobs' outputs are filled
+// in before the tree is emitted.
+//
+// --top N keeps the N largest directories (by total size) and files of a tree in bounded
+// min-heaps, one pair per thread, which are merged when the tree is complete. An entry is
+// compared with the smallest one kept before its path is built.
+
+#define AGG_WIDTH 34          ///< width of the aggregate field: "%14llu %9llu %9llu"
+#define AGG_COLUMN 98         ///< column of the aggregate field in verbose mode (after "Type")
+
+/// @brief entry of a --top heap
+struct topent {
+  unsigned long long size;    ///< size
+  char *path;                 ///< path
+};
+
+/// @brief bounded min-heaps of the largest directories and files
+struct top {
+  struct topent *dirs;        ///< largest directories
+  struct topent *files;       ///< largest files
+  unsigned int ndirs;         ///< number of entries in dirs[]
+  unsigned int nfiles;        ///< number of entries in files[]
+};
+
+static unsigned int topn = 0;                             ///< number of entries reported (--top)
+static struct top *tops = NULL;                           ///< heaps per thread (main thread last)
+static int ntops = 0;                                     ///< number of heaps in tops[]
+static __thread struct prefix tpath;                      ///< path of the current directory
+
+
+/// @brief add the size of entry @a sb to aggregate @a a
+static inline void aggAdd(struct agg *a, const struct meta *sb)
+{
+  if ((sb == NULL) || (sb->err != 0)) return;
+
+  a->size += sb->size;
+  a->blocks += sb->blocks;
+  if (S_ISREG(sb->mode)) a->files++;
+}
+
+/// @brief add aggregate @a b to aggregate @a a
+static inline void aggMerge(struct agg *a, const struct agg *b)
+{
+  a->size += b->size;
+  a->blocks += b->blocks;
+  a->files += b->files;
+}
+
+/// @brief end the line just rendered into @a out at @a start with a blank aggregate field
+///
+/// @retval offset of the field in the output buffer
+static size_t aggField(struct outbuf *out, size_t start, unsigned int flags)
+{
+  // replace the newline and align the field with the header
+  size_t llen = --out->len - start, col = flags & F_VERBOSE ? AGG_COLUMN : 54;
+  if (llen < col) ob_pad(out, col - llen);
+  ob_putc(out, ' ');
+
+  size_t pos = out->len;
+  ob_pad(out, AGG_WIDTH);
+  ob_putc(out, '\n');
+
+  return pos;
+}
+
+/// @brief fill in the aggregate field at @a field with @a a
+static void aggPrint(char *field, const struct agg *a)
+{
+  char s[3*24];
+
+  int len = snprintf(s, sizeof(s), "%14llu %9llu %9llu", a->size, a->blocks, a->files);
+  if (len > AGG_WIDTH) memset(s, '*', len = AGG_WIDTH);
+  memcpy(field + AGG_WIDTH - len, s, len);
+}
+
+/// @brief heaps of the calling thread
+static struct top *myTop(void)
+{
+  int i = pool_self();
+
+  return &tops[i >= 0 ? i : ntops-1];
+}
+
+/// @brief heap order: @a a ranks below @a b (smaller, or equal in size and later by path)
+static inline int topLess(const struct topent *a, const struct topent *b)
+{
+  if (a->size != b->size) return a->size < b->size;
+  return strcmp(a->path, b->path) > 0;
+}
+
+/// @brief check whether an entry of size @a size may go into heap @a h with @a n entries
+static inline int topWants(const struct topent *h, unsigned int n, unsigned long long size)
+{
+  return (n < topn) || (size >= h[0].size);
+}
+
+/// @brief restore the heap property of @a h with @a n entries below position @a i
+static void topSift(struct topent *h, unsigned int n, unsigned int i)
+{
+  for (;;) {
+    unsigned int min = i, l = 2*i + 1, r = 2*i + 2;
+
+    if ((l < n) && topLess(&h[l], &h[min])) min = l;
+    if ((r < n) && topLess(&h[r], &h[min])) min = r;
+    if (min == i) break;
+
+    struct topent t = h[i];
+    h[i] = h[min];
+    h[min] = t;
+    i = min;
+  }
+}
+
+/// @brief add @a path of size @a size to heap @a h with @a *n entries if it ranks among the
+///        topn largest. The path is copied.
+static void topAdd(struct topent *h, unsigned int *n, unsigned long long size, const char *path)
+{
+  struct topent t = { size, (char*)path };
+
+  if ((*n == topn) && !topLess(&h[0], &t)) return;
+
+  t.path = strdup(path);
+  if (t.path == NULL) panic("Out of memory.");
+
+  if (*n < topn) {
+    // sift up
+    unsigned int i = (*n)++;
+    while ((i > 0) && topLess(&t, &h[(i-1)/2])) {
+      h[i] = h[(i-1)/2];
+      i = (i-1)/2;
     }
+    h[i] = t;
+  } else {
+    free(h[0].path);
+    h[0] = t;
+    topSift(h, *n, 0);
+  }
+}
+
+/// @brief --top: consider directory @a path with aggregate @a a
+static void topDir(const char *path, const struct agg *a)
+{
+  struct top *t = myTop();
 
-    printf("%s\n", out);
-    free(out);
+  if (topWants(t->dirs, t->ndirs, a->size)) topAdd(t->dirs, &t->ndirs, a->size, path);
+}
 
-    //stats
-    if (flags & F_SUMMARY) {
-      switch (this->d_type) {
-        case DT_REG: stats->files++; break;
-        case DT_DIR: stats->dirs++; break;
-        case DT_LNK: stats->links++; break;
-        case DT_FIFO: stats->fifos++; break;
-        case DT_SOCK: stats->socks++; break;
-        default: ;
+/// @brief --top: consider entry @a name of size @a sb in the directory of path buffer @a path
+static void topFile(struct prefix *path, const char *name, size_t len, const struct meta *sb)
+{
+  struct top *t = myTop();
+
+  if ((sb == NULL) || (sb->err != 0) || !S_ISREG(sb->mode) ||
+      !topWants(t->files, t->nfiles, sb->size)) return;
+
+  size_t plen = path->len;
+  prefix_add(path, name, len);
+  topAdd(t->files, &t->nfiles, sb->size, path->buf);
+  prefix_cut(path, plen);
+}
+
+/// @brief qsort comparator: larger entries first
+static int topCompare(const void *a, const void *b)
+{
+  const struct topent *ta = a, *tb = b;
+
+  if (ta->size != tb->size) return ta->size > tb->size ? -1 : 1;
+  return strcmp(ta->path, tb->path);
+}
+
+/// @brief merge the heaps of all threads and print the largest directories and files
+static void topReport(void)
+{
+  for (int k = 0; k < 2; k++) {
+    struct topent *h = malloc(topn * sizeof(struct topent));
+    unsigned int n = 0;
+    if (h == NULL) panic("Out of memory.");
+
+    for (int i = 0; i < ntops; i++) {
+      struct topent *th = k ? tops[i].files : tops[i].dirs;
+      unsigned int *tn = k ? &tops[i].nfiles : &tops[i].ndirs;
+
+      for (unsigned int j = 0; j < *tn; j++) {
+        topAdd(h, &n, th[j].size, th[j].path);
+        free(th[j].path);
       }
+      *tn = 0;
+    }
 
-      if ((flags & F_VERBOSE) && stat_valid) {
-        stats->size += sb.st_size;
-        stats->blocks += sb.st_blocks;
+    qsort(h, n, sizeof(struct topent), topCompare);
+    printf("Largest %s:\n", k ? "files" : "directories");
+    for (unsigned int j = 0; j < n; j++) {
+      printf("%14llu  %s\n", h[j].size, h[j].path);
+      free(h[j].path);
+    }
+    free(h);
+  }
+  printf("\n");
+}
+
+
+/// @brief process directory @a dn and its subdirectories and print the tree
+///
+/// @param dfd file descriptor of the parent directory or AT_FDCWD
+/// @param dn directory name relative to @a dfd (or absolute path)
+/// @param pstr prefix string printed in front of each entry
+/// @param stats pointer to statistics
+/// @param flags output control flags (F_*)
+/// @param out output buffer
+/// @param job job processing this directory in parallel mode, NULL in sequential mode.
+///        Subdirectories are submitted as new jobs instead of being traversed.
+///
+/// With -d, @a out must keep its content in memory (see Directory aggregates).
+void processDir(int dfd, const char *dn, const char *pstr, struct summary *stats,
+                unsigned int flags, struct outbuf *out, struct job *job)
+{
+  struct prefix *pre = &tprefix, *path = &tpath;
+  struct dirref *ref = NULL;
+  unsigned int depth = 0, level = job != NULL ? job->level : 0;
+  const struct agg zero = { 0 };
+
+  pre->len = 0;
+  prefix_add(pre, pstr, strlen(pstr));
+
+  // --top: path of the current directory
+  if (flags & F_TOP) {
+    const char *p = job != NULL ? job->path : dn;
+    path->len = 0;
+    prefix_add(path, p, strlen(p));
+    if (path->buf[path->len-1] != '/') prefix_add(path, "/", 1);
+  }
+
+  if (openFrame(pushFrame(0), dfd, dn, pre, stats, flags, out) < 0) return;
+  frames[0]->agg = zero;
+  frames[0]->aggpos = NOAGG;
+  frames[0]->dlen = path->len;
+  depth = 1;
+
+  // parallel mode: share the descriptor with the subdirectory jobs
+  if (job != NULL) {
+    ref = malloc(sizeof(struct dirref));
+    if (ref == NULL) panic("Out of memory.");
+    ref->fd = frames[0]->fd;
+    ref->refcnt = 1;
+  }
+
+  while (depth > 0) {
+    struct frame *f = frames[depth-1];
+    struct entry e;
+
+    // directory done: return to its parent
+    if (!nextEntry(f, flags, &e)) {
+      closeFrame(f);
+      if (ref != NULL) dirref_put(ref);
+      else close(f->fd);
+
+      if (--depth > 0) {
+        // add the directory's aggregate to its parent's (post-order)
+        struct frame *p = frames[depth-1];
+        if (f->aggpos != NOAGG) aggPrint(out->buf + f->aggpos, &f->agg);
+        aggMerge(&p->agg, &f->agg);
+        if (flags & F_TOP) {
+          prefix_cut(path, f->dlen - 1);
+          topDir(path->buf, &f->agg);
+          prefix_cut(path, p->dlen);
+        }
+        prefix_cut(pre, p->plen);
+      } else if (job != NULL) {
+        // parallel mode: the subdirectory jobs are added by totalJob()
+        job->agg = f->agg;
       }
+      continue;
     }
 
-    // if entry is a directory
-    if (this->d_type == DT_DIR) {
+    // if entry is a directory that passes the filters
+    int enter = (e.type == DT_DIR) && enterDir(f->fd, e.name, e.sb, level + depth, stats, flags);
+
+    size_t start = out->len, aggpos = NOAGG;
+    printEntry(out, pre->buf, pre->len, e.name, e.len, e.last, flags & F_VERBOSE ? e.sb : NULL,
+               flags);
+    if (flags & F_SUMMARY) countEntry(stats, e.type, flags & F_VERBOSE ? e.sb : NULL, flags);
+
+    if (flags & (F_DIRSIZE | F_TOP)) {
+      aggAdd(&f->agg, e.sb);
+      if (flags & F_TOP) topFile(path, e.name, e.len, e.sb);
+      if (enter && (flags & F_DIRSIZE)) aggpos = aggField(out, start, flags);
+    }
 
+    if (enter) {
       // tree prefix string
-      char *npstr;
-    if (asprintf(&npstr, flags & F_TREE && pos<nentry-1 ? "%s| " : "%s ", pstr) == -1)
-        panic("Out of memory.");
-     if ( asprintf(&fn, "%s/", fn) == -1)
-       panic("Out of memory.");
-      processDir(fn, npstr, stats, flags);
+      if (flags & F_TREE && !e.last) prefix_add(pre, "| ", 2);
+      else prefix_add(pre, " ", 1);
+      if (flags & F_TOP) prefix_add(path, e.name, e.len);
+
+      if (job != NULL) {
+        // parallel mode: the child job takes ownership of the name, prefix, and path
+        char *cname = strdup(e.name), *npstr = strdup(pre->buf), *cpath = NULL;
+        if ((cname == NULL) || (npstr == NULL)) panic("Out of memory.");
+        if ((flags & F_TOP) && ((cpath = strdup(path->buf)) == NULL)) panic("Out of memory.");
+        __atomic_add_fetch(&ref->refcnt, 1, __ATOMIC_RELAXED);
+        newJob(job, ref, cname, npstr, cpath, aggpos, flags);
+        prefix_cut(pre, f->plen);
+        if (flags & F_TOP) prefix_cut(path, f->dlen);
+        continue;
+      }
+
+      if (flags & F_TOP) prefix_add(path, "/", 1);
+      if (openFrame(pushFrame(depth), f->fd, e.name, pre, stats, flags, out) == 0) {
+        struct frame *c = frames[depth++];
+        c->agg = zero;
+        c->aggpos = aggpos;
+        c->dlen = path->len;
+      } else {
+        // empty or unreadable directory
+        if (aggpos != NOAGG) aggPrint(out->buf + aggpos, &zero);
+        if (flags & F_TOP) {
+          prefix_cut(path, path->len - 1);
+          topDir(path->buf, &zero);
+          prefix_cut(path, f->dlen);
+        }
+        prefix_cut(pre, f->plen);
+      }
+    }
+  }
+}
+
+
+/// @brief visitor of walkDir(), called for every entry
+///
+/// @param path path of the entry
+/// @param depth depth of the entry below the root directory (entries of the root: 1)
+/// @param e entry (with metadata)
+typedef void (*visit_fn)(const char *path, unsigned int depth, const struct entry *e);
+
+/// @brief walk directory @a dn and its subdirectories in sorted order and pass each entry with
+///        its metadata and path to @a visit (--dups, --snapshot). The traversal is that of
+///        processDir() with the path of the current directory in place of the prefix.
+///
+/// @param dn directory name (absolute or relative to the current directory)
+/// @param stats pointer to statistics
+/// @param flags output control flags (F_*)
+/// @param err output buffer for errors
+/// @param visit visitor
+static void walkDir(const char *dn, struct summary *stats, unsigned int flags,
+                    struct outbuf *err, visit_fn visit)
+{
+  struct prefix *path = &tprefix;
+  unsigned int depth = 0;
+
+  // the metadata of the entries is needed, in sorted order
+  flags = (flags | F_VERBOSE) & ~F_UNSORTED;
+
+  path->len = 0;
+  prefix_add(path, dn, strlen(dn));
+  if (path->buf[path->len-1] != '/') prefix_add(path, "/", 1);
+
+  if (openFrame(pushFrame(0), AT_FDCWD, dn, path, stats, flags, err) < 0) return;
+  depth = 1;
+
+  while (depth > 0) {
+    struct frame *f = frames[depth-1];
+    struct entry e;
+
+    if (!nextEntry(f, flags, &e)) {
+      closeFrame(f);
+      close(f->fd);
+      if (--depth > 0) prefix_cut(path, frames[depth-1]->plen);
+      continue;
+    }
+
+    countEntry(stats, e.type, e.sb, flags);
+
+    prefix_add(path, e.name, e.len);
+    visit(path->buf, depth, &e);
+
+    if ((e.type == DT_DIR) && enterDir(f->fd, e.name, e.sb, depth, stats, flags)) {
+      prefix_add(path, "/", 1);
+      if (openFrame(pushFrame(depth), f->fd, e.name, path, stats, flags, err) == 0) {
+        depth++;
+        continue;
+      }
+    }
+    prefix_cut(path, f->plen);
+  }
+}
+
+/// @brief walkDir() visitor: collect regular files as duplicate candidates (see dups.c)
+static void dupVisit(const char *path, unsigned int depth, const struct entry *e)
+{
+  if ((e->sb->err == 0) && S_ISREG(e->sb->mode)) {
+    dup_add(path, e->sb->size, e->sb->dev, e->sb->ino);
+  }
+}
+
+/// @brief walkDir() visitor: add the entry to the snapshot (see snapshot.c)
+static void snapVisit(const char *path, unsigned int depth, const struct entry *e)
+{
+  snap_add(depth, e->name, e->len, e->type, e->sb);
+}
+
+
+/// @brief pool task: process the directory of job @a arg into its output buffer
+static void runJob(void *arg)
+{
+  struct job *job = arg;
+
+  // render into the worker's buffer and keep a copy of exactly the rendered size
+  if (tout.buf == NULL) ob_init(&tout, -1);
+  tout.len = 0;
+  job->out = &tout;
+
+  processDir(job->parent ? job->parent->fd : AT_FDCWD, job->dn, job->pstr, &tstats[pool_self()],
+             job->flags, job->out, job);
+  if (job->parent != NULL) dirref_put(job->parent);
+
+  job->len = tout.len;
+  job->buf = malloc(job->len);
+  if ((job->buf == NULL) && (job->len > 0)) panic("Out of memory.");
+  memcpy(job->buf, tout.buf, job->len);
+  job->out = NULL;
+
+  pthread_mutex_lock(&job_mtx);
+  job->done = 1;
+  pthread_cond_broadcast(&job_cond);
+  pthread_mutex_unlock(&job_mtx);
+}
+
+
+/// @brief create a job for directory @a dn and submit it to the pool. If @a parent is not NULL,
+///        the job's output is placed at the current end of the parent's output.
+///
+/// @param parent parent job or NULL for a root directory
+/// @param dir parent directory (a reference is transferred to the job) or NULL for a root directory
+/// @param dn directory name relative to @a dir or root path (ownership is transferred to the job)
+/// @param pstr prefix string (ownership is transferred to the job)
+/// @param path path of the directory (--top; ownership is transferred to the job) or NULL
+/// @param aggpos aggregate field of the directory's line in the parent's output or NOAGG
+/// @param flags output control flags
+/// @retval struct job* new job
+static struct job *newJob(struct job *parent, struct dirref *dir, char *dn, char *pstr,
+                          char *path, size_t aggpos, unsigned int flags)
+{
+  struct job *job = calloc(1, sizeof(struct job));
+  if (job == NULL) panic("Out of memory.");
+
+  job->parent = dir;
+  job->dn = dn;
+  job->pstr = pstr;
+  job->path = path;
+  job->aggpos = aggpos;
+  job->flags = flags;
+  job->level = parent != NULL ? parent->level + 1 : 0;
+
+  if (parent != NULL) {
+    if (parent->nchildren == parent->maxchildren) {
+      parent->maxchildren = parent->maxchildren ? 2*parent->maxchildren : 16;
+      parent->children = realloc(parent->children, parent->maxchildren*sizeof(struct child));
+      if (parent->children == NULL) panic("Out of memory.");
+    }
+    parent->children[parent->nchildren].pos = parent->out->len;
+    parent->children[parent->nchildren].job = job;
+    parent->nchildren++;
+  }
+
+  pool_submit(pool, runJob, job);
+
+  return job;
+}
+
+
+/// @brief wait for @a job and its subdirectory jobs to complete and add up their aggregates
+///        from the leaves up. The aggregate fields in the outputs are filled in, and the
+///        subdirectories are passed to the --top heaps.
+static void totalJob(struct job *job)
+{
+  pthread_mutex_lock(&job_mtx);
+  while (!job->done) pthread_cond_wait(&job_cond, &job_mtx);
+  pthread_mutex_unlock(&job_mtx);
+
+  for (unsigned int i = 0; i < job->nchildren; i++) {
+    struct job *c = job->children[i].job;
+
+    totalJob(c);
+    aggMerge(&job->agg, &c->agg);
+    if (c->aggpos != NOAGG) aggPrint(job->buf + c->aggpos, &c->agg);
+    if (c->path != NULL) topDir(c->path, &c->agg);
+  }
+}
+
+
+/// @brief wait for @a job to complete, write its output and that of its subdirectories in order
+///        to @a out, and free the job
+static void emitJob(struct job *job, struct outbuf *out)
+{
+  pthread_mutex_lock(&job_mtx);
+  while (!job->done) pthread_cond_wait(&job_cond, &job_mtx);
+  pthread_mutex_unlock(&job_mtx);
+
+  size_t pos = 0;
+  for (unsigned int i = 0; i < job->nchildren; i++) {
+    ob_write(out, job->buf + pos, job->children[i].pos - pos);
+    pos = job->children[i].pos;
+    emitJob(job->children[i].job, out);
+  }
+  ob_write(out, job->buf + pos, job->len - pos);
+
+  free(job->buf);
+  free(job->children);
+  free(job->dn);
+  free(job->pstr);
+  free(job->path);
+  free(job);
+}
+
+
+/// @brief add the per-thread summaries to @a stats
+///
+/// @param stats pointer to statistics
+/// @param nthreads number of threads in the pool
+static void mergeStats(struct summary *stats, int nthreads)
+{
+  for (int i = 0; i < nthreads; i++) {
+    stats->dirs   += tstats[i].dirs;
+    stats->files  += tstats[i].files;
+    stats->links  += tstats[i].links;
+    stats->fifos  += tstats[i].fifos;
+    stats->socks  += tstats[i].socks;
+    stats->size   += tstats[i].size;
+    stats->blocks += tstats[i].blocks;
+    stats->hlinks += tstats[i].hlinks;
+    stats->excluded += tstats[i].excluded;
+    stats->pruned += tstats[i].pruned;
+  }
+}
+
+
+/// @brief process directory @a dn on the thread pool and print its tree
+///
+/// @param dn absolute or relative path string
+/// @param stats pointer to statistics; the per-thread summaries are added to it
+/// @param flags output control flags (F_*)
+/// @param out output buffer
+/// @param nthreads number of threads in the pool
+static void processDirParallel(const char *dn, struct summary *stats, unsigned int flags,
+                               struct outbuf *out, int nthreads)
+{
+  char *jdn = strdup(dn), *jpstr = strdup(""), *jpath = NULL;
+  if ((jdn == NULL) || (jpstr == NULL)) panic("Out of memory.");
+  if ((flags & F_TOP) && ((jpath = strdup(dn)) == NULL)) panic("Out of memory.");
+
+  memset(tstats, 0, nthreads*sizeof(struct summary));
+
+  struct job *root = newJob(NULL, NULL, jdn, jpstr, jpath, NOAGG, flags);
+  if (flags & (F_DIRSIZE | F_TOP)) totalJob(root);
+  emitJob(root, out);
+  pool_wait(pool);
+
+  mergeStats(stats, nthreads);
+}
+
 
-      free(npstr);
+// Summary-only mode
+// =================
+// With -s alone, no entries are printed, so nothing needs to be sorted or rendered. Each
+// directory is scanned once: its entries are counted by the type reported by getdents64, and
+// only the names of its subdirectories are kept to descend into them (dl_scan()). With an
+// index (-I), unchanged directories contribute the stored summary of their entries instead.
+// With exclude patterns, the full listing is read and every name is matched (see Pruning).
+// In parallel mode, every directory is a task on the pool; the order does not matter.
+
+/// @brief count the entries of listing @a dl into @a stats, skipping excluded ones
+static void countListing(const struct dirlist *dl, struct summary *stats)
+{
+  uint64_t count[16] = { 0 };
+
+  for (unsigned int i = 0; i < dl->n; i++) {
+    if ((nexclude > 0) && excluded(dl_name(dl, &dl->ent[i]))) stats->excluded++;
+    else count[dl->ent[i].type & 0xf]++;
+  }
+
+  stats->dirs  += count[DT_DIR];
+  stats->files += count[DT_REG];
+  stats->links += count[DT_LNK];
+  stats->fifos += count[DT_FIFO];
+  stats->socks += count[DT_SOCK];
+}
+
+/// @brief count the entries of the open directory @a fd into @a stats and return its
+///        subdirectories in @a dl
+///
+/// @param fd open directory
+/// @param stats pointer to statistics
+/// @param dl receives the subdirectories (and possibly other entries; check the type)
+/// @retval 1 if @a dl points into the index and must not be freed
+/// @retval 0 if @a dl must be freed with dl_free()
+static int countEntries(int fd, struct summary *stats, struct dirlist *dl)
+{
+  struct stat dsb;
+
+  if (idx_active() && (fstat(fd, &dsb) == 0)) {
+    const struct meta *m;
+    struct idx_sum sum;
+
+    if (idx_lookup(&dsb, 0, dl, &m, &sum)) {
+      idx_store(&dsb, dl, m);
+      if (nexclude > 0) countListing(dl, stats);
+      else {
+        stats->dirs  += sum.dirs;
+        stats->files += sum.files;
+        stats->links += sum.links;
+        stats->fifos += sum.fifos;
+        stats->socks += sum.socks;
+      }
+      return 1;
+    }
+
+    // keep the index up to date: read and store the full listing
+    dl_init(dl);
+    if (dl_read(dl, fd) < 0) perror(NULL);
+    else {
+      dl_sort(dl);
+      idx_store(&dsb, dl, NULL);
+    }
+    countListing(dl, stats);
+  } else if (nexclude > 0) {
+    // the names are needed to match the exclude patterns
+    dl_init(dl);
+    if (dl_read(dl, fd) < 0) perror(NULL);
+    countListing(dl, stats);
+  } else {
+    uint64_t count[16] = { 0 };
+
+    dl_init(dl);
+    if (dl_scan(dl, fd, count) < 0) perror(NULL);
+
+    stats->dirs  += count[DT_DIR];
+    stats->files += count[DT_REG];
+    stats->links += count[DT_LNK];
+    stats->fifos += count[DT_FIFO];
+    stats->socks += count[DT_SOCK];
+  }
+
+  return 0;
+}
+
+/// @brief count the entries of directory @a dn and its subdirectories (summary-only mode)
+///
+/// @param dfd file descriptor of the parent directory or AT_FDCWD
+/// @param dn directory name relative to @a dfd (or absolute path)
+/// @param stats pointer to statistics
+/// @param flags output control flags (F_*)
+void countDir(int dfd, const char *dn, struct summary *stats, unsigned int flags)
+{
+  /// @brief directory being counted
+  struct cframe {
+    int fd;                   ///< open directory
+    int cached;               ///< listing points into the index
+    unsigned int pos;         ///< next entry to check for a subdirectory
+    struct dirlist dl;        ///< subdirectories (and possibly other entries)
+  } *stack = NULL;
+  unsigned int depth = 0, max = 0;
+
+  // iterative like processDir(): enter dn, then descend into one subdirectory after the other
+  while ((dn != NULL) || (depth > 0)) {
+    if (dn != NULL) {
+      int fd = openat(dfd, dn, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (fd < 0) fprintf(stderr, "%s: %s\n", dn, strerror(errno));
+      else {
+        if (depth == max) {
+          max = max ? 2*max : 16;
+          stack = realloc(stack, max*sizeof(struct cframe));
+          if (stack == NULL) panic("Out of memory.");
+        }
+        struct cframe *c = &stack[depth++];
+        c->fd = fd;
+        c->cached = countEntries(fd, stats, &c->dl);
+        c->pos = 0;
+      }
+      dn = NULL;
+      continue;
+    }
+
+    // next subdirectory to enter; the name lives in the listing's arena and stays valid when
+    // the stack grows
+    struct cframe *c = &stack[depth-1];
+    while ((dn == NULL) && (c->pos < c->dl.n)) {
+      const struct dentry *d = &c->dl.ent[c->pos++];
+      const char *name = dl_name(&c->dl, d);
+
+      if ((d->type == DT_DIR) && !((nexclude > 0) && excluded(name)) &&
+          enterDir(c->fd, name, NULL, depth, stats, flags)) {
+        dfd = c->fd;
+        dn = name;
+      }
+    }
+
+    if (dn == NULL) {
+      if (!c->cached) dl_free(&c->dl);
+      close(c->fd);
+      depth--;
     }
-    free(fn);
   }
-  free(entries);
+
+  free(stack);
+}
+
+/// @brief counting task of one directory (parallel summary-only mode)
+struct ctask {
+  struct dirref *parent;      ///< parent directory, NULL for a root directory
+  char *dn;                   ///< directory name relative to parent (root: path)
+  unsigned int flags;         ///< output control flags
+  unsigned int level;         ///< depth of the directory below the root directory
+};
+
+/// @brief pool task: count the entries of the directory of task @a arg and submit tasks for its
+///        subdirectories
+static void countTask(void *arg)
+{
+  struct ctask *task = arg;
+  struct dirlist dl;
+
+  int fd = openat(task->parent ? task->parent->fd : AT_FDCWD, task->dn,
+                  O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (task->parent != NULL) dirref_put(task->parent);
+  if (fd < 0) {
+    fprintf(stderr, "%s: %s\n", task->dn, strerror(errno));
+    free(task->dn);
+    free(task);
+    return;
+  }
+
+  int cached = countEntries(fd, &tstats[pool_self()], &dl);
+
+  struct dirref *ref = malloc(sizeof(struct dirref));
+  if (ref == NULL) panic("Out of memory.");
+  ref->fd = fd;
+  ref->refcnt = 1;
+
+  for (unsigned int i = 0; i < dl.n; i++) {
+    const char *name = dl_name(&dl, &dl.ent[i]);
+
+    if ((dl.ent[i].type != DT_DIR) || ((nexclude > 0) && excluded(name)) ||
+        !enterDir(fd, name, NULL, task->level + 1, &tstats[pool_self()], task->flags)) continue;
+
+    struct ctask *child = malloc(sizeof(struct ctask));
+    if ((child == NULL) || ((child->dn = strdup(name)) == NULL)) panic("Out of memory.");
+    child->parent = ref;
+    child->flags = task->flags;
+    child->level = task->level + 1;
+    __atomic_add_fetch(&ref->refcnt, 1, __ATOMIC_RELAXED);
+    pool_submit(pool, countTask, child);
+  }
+
+  if (!cached) dl_free(&dl);
+  dirref_put(ref);
+  free(task->dn);
+  free(task);
+}
+
+/// @brief count the entries of directory @a dn on the thread pool (summary-only mode)
+///
+/// @param dn absolute or relative path string
+/// @param stats pointer to statistics; the per-thread summaries are added to it
+/// @param flags output control flags (F_*)
+/// @param nthreads number of threads in the pool
+static void countDirParallel(const char *dn, struct summary *stats, unsigned int flags,
+                             int nthreads)
+{
+  struct ctask *task = malloc(sizeof(struct ctask));
+  if ((task == NULL) || ((task->dn = strdup(dn)) == NULL)) panic("Out of memory.");
+  task->parent = NULL;
+  task->flags = flags;
+  task->level = 0;
+
+  memset(tstats, 0, nthreads*sizeof(struct summary));
+
+  pool_submit(pool, countTask, task);
+  pool_wait(pool);
+
+  mergeStats(stats, nthreads);
 }
 
 
@@ -283,17 +1471,40 @@ void syntax(const char *argv0, const char *error, ...)
 
   assert(argv0 != NULL);
 
-  fprintf(stderr, "Usage %s [-t] [-s] [-v] [-h] [path...]\n"
+  fprintf(stderr, "Usage %s [-t] [-s] [-v] [-U] [-u] [-x] [-L depth] [--exclude GLOB]... [--dups]\n"
+                  "      [--snapshot file] [--diff old new] [-d] [--top N] [-j N] [-Q N] [-I file]\n"
+                  "      [-M size] [-h] [path...]\n"
                   "Gather information about directory trees. If no path is given, the current directory\n"
                   "is analyzed.\n"
                   "\n"
                   "Options:\n"
                   " -t        print the directory tree (default if no other option specified)\n"
-                  " -s        print summary of directories (total number of files, total file size, etc)\n"
+                  " -s        print summary of directories (total number of files, total file size, etc).\n"
+                  "           Alone, only the summary is printed.\n"
                   " -v        print detailed information for each file. Turns on tree view.\n"
+                  " -U        print entries unsorted, in directory order, as they are read. Ignores -j and -I.\n"
+                  " -u        with -v, count the size of a file with several hard links only once\n"
+                  " -x        do not enter directories on other file systems\n"
+                  " -L depth  list at most 'depth' levels below each directory\n"
+                  " --exclude GLOB\n"
+                  "           skip entries whose name matches GLOB (repeatable)\n"
+                  " --dups    find duplicate files instead of printing the trees; hashes on the -j threads\n"
+                  " --snapshot file\n"
+                  "           record the trees in snapshot 'file' instead of printing them\n"
+                  " --diff old new\n"
+                  "           print the entries added, removed, and modified between two snapshots\n"
+                  " -d        print the total size, blocks, and number of files below each directory\n"
+                  "           on its line\n"
+                  " --top N   print the N largest directories (by total size) and files of each tree\n"
+                  " -j N      process directories in parallel on N threads (max %d)\n"
+                  " -Q N      keep up to N metadata requests per directory in flight with io_uring (max %d)\n"
+                  " -I file   reuse the listings of unchanged directories stored in index 'file' and\n"
+                  "           update it\n"
+                  " -M size   sort directories whose listing exceeds 'size' bytes (suffix K, M, G) in\n"
+                  "           temporary files\n"
                   " -h        print this help\n"
                   " path...   list of space-separated paths (max %d). Default is the current directory.\n",
-                  basename(argv0), MAX_DIR);
+                  basename(argv0), POOL_MAX_THREADS, META_MAX_INFLIGHT, MAX_DIR);
 
   exit(EXIT_FAILURE);
 }
@@ -311,6 +1522,10 @@ int main(int argc, char *argv[])
 
   struct summary dstat, tstat;
   unsigned int flags = 0;
+  int nthreads = 1;
+  int inflight = 0;
+  const char *idxfile = NULL;
+  const char *snapfile = NULL;
 
   //
   // parse arguments
@@ -321,6 +1536,72 @@ int main(int argc, char *argv[])
       if      (!strcmp(argv[i], "-t")) flags |= F_TREE;
       else if (!strcmp(argv[i], "-s")) flags |= F_SUMMARY;
       else if (!strcmp(argv[i], "-v")) flags |= F_VERBOSE;
+      else if (!strcmp(argv[i], "-U")) flags |= F_UNSORTED;
+      else if (!strcmp(argv[i], "-u")) flags |= F_UNIQUE;
+      else if (!strcmp(argv[i], "-x")) flags |= F_XDEV;
+      else if (!strcmp(argv[i], "-L")) {
+        char *end;
+        if (i+1 >= argc) syntax(argv[0], "Missing argument for option '-L'.");
+        long depth = strtol(argv[++i], &end, 10);
+        if ((*end != '\0') || (depth < 1)) syntax(argv[0], "Invalid depth '%s'.", argv[i]);
+        maxdepth = depth;
+      }
+      else if (!strcmp(argv[i], "--dups")) flags |= F_DUPS;
+      else if (!strcmp(argv[i], "-d")) flags |= F_DIRSIZE;
+      else if (!strcmp(argv[i], "--top")) {
+        char *end;
+        if (i+1 >= argc) syntax(argv[0], "Missing argument for option '--top'.");
+        long n = strtol(argv[++i], &end, 10);
+        if ((*end != '\0') || (n < 1) || (n > 1000000)) syntax(argv[0], "Invalid count '%s'.", argv[i]);
+        topn = n;
+        flags |= F_TOP;
+      }
+      else if (!strcmp(argv[i], "--snapshot")) {
+        if (i+1 >= argc) syntax(argv[0], "Missing argument for option '--snapshot'.");
+        snapfile = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--diff")) {
+        if (i+2 >= argc) syntax(argv[0], "Missing arguments for option '--diff'.");
+        return snap_diff(argv[i+1], argv[i+2]) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
+      else if (!strcmp(argv[i], "--exclude")) {
+        if (i+1 >= argc) syntax(argv[0], "Missing argument for option '--exclude'.");
+        if (nexclude == MAX_EXCLUDE) syntax(argv[0], "Too many exclude patterns.");
+        exclude[nexclude++] = argv[++i];
+      }
+      else if (!strcmp(argv[i], "-j")) {
+        char *end;
+        if (i+1 >= argc) syntax(argv[0], "Missing argument for option '-j'.");
+        nthreads = strtol(argv[++i], &end, 10);
+        if ((*end != '\0') || (nthreads < 1) || (nthreads > POOL_MAX_THREADS)) {
+          syntax(argv[0], "Invalid number of threads '%s'.", argv[i]);
+        }
+      }
+      else if (!strcmp(argv[i], "-Q")) {
+        char *end;
+        if (i+1 >= argc) syntax(argv[0], "Missing argument for option '-Q'.");
+        inflight = strtol(argv[++i], &end, 10);
+        if ((*end != '\0') || (inflight < 1) || (inflight > META_MAX_INFLIGHT)) {
+          syntax(argv[0], "Invalid number of requests '%s'.", argv[i]);
+        }
+      }
+      else if (!strcmp(argv[i], "-I")) {
+        if (i+1 >= argc) syntax(argv[0], "Missing argument for option '-I'.");
+        idxfile = argv[++i];
+      }
+      else if (!strcmp(argv[i], "-M")) {
+        char *end;
+        if (i+1 >= argc) syntax(argv[0], "Missing argument for option '-M'.");
+        unsigned long long size = strtoull(argv[++i], &end, 10);
+        switch (*end) {
+          case 'G': size *= 1024;   // fall through
+          case 'M': size *= 1024;   // fall through
+          case 'K': size *= 1024; end++; break;
+          default: ;
+        }
+        if ((*end != '\0') || (size == 0)) syntax(argv[0], "Invalid memory size '%s'.", argv[i]);
+        sortmem = size;
+      }
       else if (!strcmp(argv[i], "-h")) syntax(argv[0], NULL);
       else syntax(argv[0], "Unrecognized option '%s'.", argv[i]);
     } else {
@@ -336,27 +1617,118 @@ int main(int argc, char *argv[])
   // if no directory was specified, use the current directory
   if (ndir == 0) directories[ndir++] = CURDIR;
 
+  if ((snapfile != NULL) && (flags & F_DUPS)) {
+    syntax(argv[0], "Options '--snapshot' and '--dups' cannot be combined.");
+  }
+  if (((snapfile != NULL) || (flags & F_DUPS)) && (flags & (F_DIRSIZE | F_TOP))) {
+    syntax(argv[0], "Options '-d' and '--top' print trees and cannot be combined with '%s'.",
+           snapfile != NULL ? "--snapshot" : "--dups");
+  }
+
+
+  //
+  // set up metadata retrieval and thread pool for parallel mode
+  //
+  // statx only the fields needed (see meta.c)
+  unsigned int fields = 0;
+  if ((flags & (F_UNIQUE | F_DUPS)) || (snapfile != NULL)) fields |= META_INODE;
+  if (snapfile != NULL) fields |= META_MTIME;
+  meta_init(inflight, fields);
+
+  if ((idxfile != NULL) && !(flags & F_UNSORTED) && (idx_open(idxfile) < 0)) {
+    perror(idxfile);
+    panic(NULL);
+  }
+
+  if ((snapfile != NULL) && (snap_create(snapfile) < 0)) {
+    perror(snapfile);
+    panic(NULL);
+  }
+
+  if (nthreads > 1) {
+    pool = pool_create(nthreads);
+    tstats = calloc(nthreads, sizeof(struct summary));
+    if ((pool == NULL) || (tstats == NULL)) panic("Cannot create thread pool.");
+  }
+
+  // --top: a pair of heaps per worker thread and one for the main thread
+  if (flags & F_TOP) {
+    ntops = (pool != NULL ? nthreads : 0) + 1;
+    tops = calloc(ntops, sizeof(struct top));
+    if (tops == NULL) panic("Out of memory.");
+    for (int i = 0; i < ntops; i++) {
+      tops[i].dirs = malloc(topn * sizeof(struct topent));
+      tops[i].files = malloc(topn * sizeof(struct topent));
+      if ((tops[i].dirs == NULL) || (tops[i].files == NULL)) panic("Out of memory.");
+    }
+  }
+
 
   //
   // process each directory
   //
   // TODO
+  struct outbuf out, err;
+  ob_init(&out, STDOUT_FILENO);
+  ob_init(&err, STDERR_FILENO);
 
   memset(&tstat, 0, sizeof(tstat));
   for(int i=0; i<ndir; i++){
     memset(&dstat, 0, sizeof(dstat));
 
+    // duplicate finder: collect the candidates of all directories and report them below
+    if (flags & F_DUPS) {
+      walkDir(directories[i], &dstat, flags, &err, dupVisit);
+      ob_flush(&err);
+      continue;
+    }
+
+    // snapshot: record the tree instead of printing it
+    if (snapfile != NULL) {
+      snap_root(directories[i]);
+      walkDir(directories[i], &dstat, flags, &err, snapVisit);
+      ob_flush(&err);
+      continue;
+    }
+
     // print header if summary mode
     if (flags & F_SUMMARY) {
       if(flags & F_VERBOSE) {
-    printf("%-54s %8s:%-8s %10s %8s %s\n", "Name", "User", "Group", "Size", "Blocks", "Type");
+    printf("%-54s %8s:%-8s %10s %8s %s", "Name", "User", "Group", "Size", "Blocks", "Type");
       } else {
-    printf("%-54s\n", "Name");
+    printf("%-54s", "Name");
       }
+    if (flags & F_DIRSIZE) printf(" %14s %9s %9s", "Total", "Blocks", "Files");
+    printf("\n");
     printf("----------------------------------------------------------------------------------------------------\n");
     printf("%s\n", directories[i]);
     }
-    processDir(directories[i], "", &dstat, flags);
+
+    // -x: stay on the file system of the root directory
+    struct stat rsb;
+    if ((flags & F_XDEV) && (stat(directories[i], &rsb) == 0)) rootdev = rsb.st_dev;
+
+    // the tree is written directly to the file descriptor; flush stdio around it
+    fflush(stdout);
+    if ((flags & ~(F_UNSORTED | F_UNIQUE | F_XDEV)) == F_SUMMARY) {
+      // summary only: count without printing entries
+      if (pool != NULL) countDirParallel(directories[i], &dstat, flags, nthreads);
+      else countDir(AT_FDCWD, directories[i], &dstat, flags);
+    }
+    else if ((pool != NULL) && !(flags & F_UNSORTED)) {
+      processDirParallel(directories[i], &dstat, flags, &out, nthreads);
+    }
+    else if (flags & F_DIRSIZE) {
+      // the aggregate fields are filled in after the subtrees: keep the tree in memory
+      struct outbuf mem;
+      ob_init(&mem, -1);
+      processDir(AT_FDCWD, directories[i], "", &dstat, flags, &mem, NULL);
+      ob_write(&out, mem.buf, mem.len);
+      ob_free(&mem);
+    }
+    else processDir(AT_FDCWD, directories[i], "", &dstat, flags, &out, NULL);
+    ob_flush(&out);
+
     // print footer and stat
     if (flags & F_SUMMARY){
       char *filestat, *dirstat, *linkstat, *pipestat, *socketstat, *summarystat;
@@ -393,8 +1765,19 @@ int main(int argc, char *argv[])
     if(asprintf(&summarystat, "%s%s%s%s%s", filestat, dirstat, linkstat, pipestat, socketstat)==-1) panic("Out of memory.");
 
     printf("----------------------------------------------------------------------------------------------------\n");
-    printf("%-68s %14llu %9llu\n\n",summarystat,dstat.size , dstat.blocks);
+    printf("%-68s %14llu %9llu\n",summarystat,dstat.size , dstat.blocks);
+    if ((flags & (F_UNIQUE | F_VERBOSE)) == (F_UNIQUE | F_VERBOSE)) {
+      printf("%llu hard link%s counted once, inode set uses %zu bytes\n", dstat.hlinks,
+             dstat.hlinks == 1 ? "" : "s", ino_memory());
+    }
+    if ((maxdepth > 0) || (nexclude > 0) || (flags & F_XDEV)) {
+      printf("%u entr%s excluded, %u director%s not entered\n", dstat.excluded,
+             dstat.excluded == 1 ? "y" : "ies", dstat.pruned, dstat.pruned == 1 ? "y" : "ies");
+    }
+    printf("\n");
     }
+    if (flags & F_TOP) topReport();
+    ino_free();
     tstat.blocks += dstat.blocks;
     tstat.dirs  += dstat.dirs;
     tstat.fifos += dstat.fifos;
@@ -402,13 +1785,26 @@ int main(int argc, char *argv[])
     tstat.links += dstat.links;
     tstat.size += dstat.size;
     tstat.socks += dstat.socks;
+    tstat.hlinks += dstat.hlinks;
+    tstat.excluded += dstat.excluded;
+    tstat.pruned += dstat.pruned;
    }
 
 
+  if (flags & F_DUPS) {
+    dup_report(pool);
+    dup_free();
+  }
+
+  if ((snapfile != NULL) && (snap_close() < 0)) {
+    perror(snapfile);
+    panic(NULL);
+  }
+
   //
   // print grand total
   //
-  if ((flags & F_SUMMARY) && (ndir > 1)) {
+  if ((flags & F_SUMMARY) && !(flags & F_DUPS) && (snapfile == NULL) && (ndir > 1)) {
     printf("Analyzed %d directories:\n"
            "  total # of files:        %16d\n"
            "  total # of directories:  %16d\n"
@@ -421,10 +1817,30 @@ int main(int argc, char *argv[])
       printf("  total file size:         %16llu\n"
              "  total # of blocks:       %16llu\n",
              tstat.size, tstat.blocks);
+      if (flags & F_UNIQUE) printf("  total # of hard links:   %16llu\n", tstat.hlinks);
+    }
+    if ((maxdepth > 0) || (nexclude > 0) || (flags & F_XDEV)) {
+      printf("  total # excluded:        %16d\n"
+             "  total # not entered:     %16d\n",
+             tstat.excluded, tstat.pruned);
     }
 
   }
 
+  if (pool != NULL) {
+    pool_destroy(pool);
+    free(tstats);
+  }
+  for (int i = 0; i < ntops; i++) {
+    free(tops[i].dirs);
+    free(tops[i].files);
+  }
+  free(tops);
+  idx_close();
+  idc_free();
+  ob_free(&out);
+  ob_free(&err);
+
   //
   // that's all, folks
   //
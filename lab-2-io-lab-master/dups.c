@@ -0,0 +1,443 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief duplicate file finder
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+// Duplicate finder
+// ================
+// With --dups, the traversal passes every non-empty regular file to dup_add(); nothing is read
+// yet. dup_report() then narrows the candidates down in stages:
+//
+// 1. Size: only files sharing their size with a file of another inode can be duplicates. Files
+//    of a unique size are never opened, and further names of a hard-linked file are dropped.
+// 2. Head: the first DUP_HEAD bytes of the remaining files are hashed. For files up to DUP_HEAD
+//    bytes this already is the hash of the whole content.
+// 3. Content: files whose size and head hash collide with another file are hashed to the end.
+//    Hashing continues from the state after the head, so every byte is read at most once.
+//
+// Files with equal size and content hash form a duplicate set; all but one copy of each set are
+// reclaimable. The hash is a 128-bit digest of the four 64-bit lanes of an xxHash64-like
+// function: fast enough to keep up with the storage, but not cryptographic.
+//
+// The files of a stage are hashed as tasks on the thread pool (-j), with one read buffer of
+// DUP_CHUNK bytes per thread.
+//
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dups.h"
+
+#define P1 11400714785074694791ull        ///< hash prime 1
+#define P2 14029467366897019727ull        ///< hash prime 2
+#define P3  1609587929392839161ull        ///< hash prime 3
+#define P4  9650029242287828579ull        ///< hash prime 4
+#define P5  2870177450012600261ull        ///< hash prime 5
+
+/// @brief streaming hash state
+struct dhash {
+  uint64_t v[4];                          ///< lanes
+  uint64_t len;                           ///< bytes hashed so far
+};
+
+/// @brief state of a candidate
+enum { DS_NONE, DS_HEAD, DS_FULL, DS_UNIQUE, DS_ERROR };
+
+/// @brief candidate file
+struct dfile {
+  uint64_t size;                          ///< size
+  uint64_t dev;                           ///< device
+  uint64_t ino;                           ///< inode number
+  size_t path;                            ///< offset of the path in the path arena
+  int state;                              ///< DS_*
+  struct dhash h;                         ///< hash state after the head
+  uint64_t d[2];                          ///< digest (of the head or the content, see state)
+};
+
+static struct dfile *files = NULL;        ///< candidates in traversal order
+static size_t nfiles = 0, maxfiles = 0;   ///< number of candidates, capacity of files[]
+static char *paths = NULL;                ///< path arena
+static size_t plen = 0, pmax = 0;         ///< used size and capacity of the path arena
+static __thread char *rbuf = NULL;        ///< read buffer of the calling thread
+
+
+//--------------------------------------------------------------------------------------------------
+// hash
+//
+
+/// @brief rotate @a x left by @a r bits
+static inline uint64_t rotl(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+/// @brief load a 64-bit little-endian word from @a p
+static inline uint64_t load64(const unsigned char *p)
+{
+  uint64_t x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+/// @brief mix @a in into lane @a acc
+static inline uint64_t dh_round(uint64_t acc, uint64_t in)
+{
+  return rotl(acc + in*P2, 31) * P1;
+}
+
+/// @brief initialize hash state @a h
+static void dh_init(struct dhash *h)
+{
+  h->v[0] = P1 + P2;
+  h->v[1] = P2;
+  h->v[2] = 0;
+  h->v[3] = -P1;
+  h->len  = 0;
+}
+
+/// @brief hash the @a n bytes at @a p; @a n must be a multiple of 32 except in dh_final()
+static void dh_update(struct dhash *h, const unsigned char *p, size_t n)
+{
+  for (size_t i = 0; i + 32 <= n; i += 32) {
+    h->v[0] = dh_round(h->v[0], load64(p+i));
+    h->v[1] = dh_round(h->v[1], load64(p+i+8));
+    h->v[2] = dh_round(h->v[2], load64(p+i+16));
+    h->v[3] = dh_round(h->v[3], load64(p+i+24));
+  }
+  h->len += n & ~(size_t)31;
+}
+
+/// @brief finalize avalanche of @a x
+static inline uint64_t dh_mix(uint64_t x)
+{
+  x ^= x >> 33; x *= P2;
+  x ^= x >> 29; x *= P3;
+  x ^= x >> 32;
+  return x;
+}
+
+/// @brief hash the last @a n bytes at @a p and store the 128-bit digest of @a h in @a d
+static void dh_final(const struct dhash *hs, const unsigned char *p, size_t n, uint64_t d[2])
+{
+  struct dhash h = *hs;
+  dh_update(&h, p, n);
+
+  const unsigned char *t = p + (n & ~(size_t)31);
+  size_t tn = n & 31;
+  uint64_t a = rotl(h.v[0], 1) + rotl(h.v[1], 7) + rotl(h.v[2], 12) + rotl(h.v[3], 18);
+  uint64_t b = rotl(h.v[0], 18) + rotl(h.v[1], 12) + rotl(h.v[2], 7) + rotl(h.v[3], 1);
+
+  for (int i = 0; i < 4; i++) {
+    a = (a ^ dh_round(0, h.v[i])) * P1 + P4;
+    b = (b ^ dh_round(0, h.v[3-i])) * P1 + P4;
+  }
+  a += h.len + tn;
+  b += (h.len + tn) * P5;
+
+  for (; tn >= 8; t += 8, tn -= 8) {
+    a = rotl(a ^ dh_round(0, load64(t)), 27) * P1 + P4;
+    b = rotl(b ^ dh_round(0, load64(t)), 29) * P2 + P3;
+  }
+  for (; tn > 0; t++, tn--) {
+    a = rotl(a ^ (*t * P5), 11) * P1;
+    b = rotl(b ^ (*t * P1), 13) * P5;
+  }
+
+  d[0] = dh_mix(a);
+  d[1] = dh_mix(b);
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// hashing tasks
+//
+
+/// @brief read up to @a n bytes of @a fd into @a buf, retrying short reads
+static ssize_t readFull(int fd, char *buf, size_t n)
+{
+  size_t done = 0;
+
+  while (done < n) {
+    ssize_t res = read(fd, buf + done, n - done);
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (res == 0) break;
+    done += res;
+  }
+
+  return done;
+}
+
+/// @brief hash the head of candidate @a f
+///
+/// @retval 0 on success
+/// @retval -1 on error (errno is set)
+static int hashHeadOf(struct dfile *f)
+{
+  int fd = open(paths + f->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+
+  size_t n = f->size < DUP_HEAD ? f->size : DUP_HEAD;
+  ssize_t res = readFull(fd, rbuf, n);
+  close(fd);
+  if (res < 0) return -1;
+  if ((size_t)res != n) {
+    // the file shrank since it was listed
+    errno = EIO;
+    return -1;
+  }
+
+  dh_init(&f->h);
+  if (f->size <= DUP_HEAD) {
+    dh_final(&f->h, (unsigned char*)rbuf, n, f->d);
+    f->state = DS_FULL;
+  } else {
+    dh_update(&f->h, (unsigned char*)rbuf, n);
+    dh_final(&f->h, NULL, 0, f->d);
+    f->state = DS_HEAD;
+  }
+
+  return 0;
+}
+
+/// @brief hash the rest of candidate @a f after its head
+///
+/// @retval 0 on success
+/// @retval -1 on error (errno is set)
+static int hashRestOf(struct dfile *f)
+{
+  int fd = open(paths + f->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+  posix_fadvise(fd, DUP_HEAD, 0, POSIX_FADV_SEQUENTIAL);
+
+  uint64_t pos = DUP_HEAD;
+  while (pos < f->size) {
+    size_t n = f->size - pos < DUP_CHUNK ? f->size - pos : DUP_CHUNK;
+    ssize_t res = pread(fd, rbuf, n, pos);
+    if ((res < 0) && (errno == EINTR)) continue;
+    if (res <= 0) {
+      // error or the file shrank since it was listed
+      if (res == 0) errno = EIO;
+      close(fd);
+      return -1;
+    }
+
+    // hash whole stripes and carry a partial one over to the next read
+    pos += res;
+    if (pos < f->size) {
+      size_t whole = res & ~(ssize_t)31;
+      dh_update(&f->h, (unsigned char*)rbuf, whole);
+      pos -= res - whole;
+    } else {
+      dh_final(&f->h, (unsigned char*)rbuf, res, f->d);
+    }
+  }
+  close(fd);
+
+  f->state = DS_FULL;
+
+  return 0;
+}
+
+/// @brief hash candidate @a f with function @a fn; report and drop it on errors
+static void hashFile(struct dfile *f, int (*fn)(struct dfile *f))
+{
+  if ((rbuf == NULL) && ((rbuf = malloc(DUP_CHUNK)) == NULL)) errno = ENOMEM;
+  else if (fn(f) == 0) return;
+
+  fprintf(stderr, "%s: %s\n", paths + f->path, strerror(errno));
+  f->state = DS_ERROR;
+}
+
+/// @brief pool task: hash the head of candidate @a arg (stage 2)
+static void hashHead(void *arg)
+{
+  hashFile(arg, hashHeadOf);
+}
+
+/// @brief pool task: hash the rest of candidate @a arg (stage 3)
+static void hashRest(void *arg)
+{
+  hashFile(arg, hashRestOf);
+}
+
+/// @brief run @a fn on every candidate in state @a state, on pool @a p if not NULL
+static void runStage(struct pool *p, pool_fn fn, int state)
+{
+  for (size_t i = 0; i < nfiles; i++) {
+    if (files[i].state != state) continue;
+    if (p != NULL) pool_submit(p, fn, &files[i]);
+    else fn(&files[i]);
+  }
+  if (p != NULL) pool_wait(p);
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// grouping
+//
+
+/// @brief order of candidates: by size, inode, and traversal order
+static int byInode(const void *a, const void *b)
+{
+  const struct dfile *fa = *(struct dfile* const*)a, *fb = *(struct dfile* const*)b;
+
+  if (fa->size != fb->size) return fa->size < fb->size ? -1 : 1;
+  if (fa->dev != fb->dev) return fa->dev < fb->dev ? -1 : 1;
+  if (fa->ino != fb->ino) return fa->ino < fb->ino ? -1 : 1;
+  return fa < fb ? -1 : fa > fb;
+}
+
+/// @brief order of candidates: by size (largest first), digest, and traversal order
+static int byDigest(const void *a, const void *b)
+{
+  const struct dfile *fa = *(struct dfile* const*)a, *fb = *(struct dfile* const*)b;
+
+  if (fa->size != fb->size) return fa->size > fb->size ? -1 : 1;
+  if (fa->d[0] != fb->d[0]) return fa->d[0] < fb->d[0] ? -1 : 1;
+  if (fa->d[1] != fb->d[1]) return fa->d[1] < fb->d[1] ? -1 : 1;
+  return fa < fb ? -1 : fa > fb;
+}
+
+/// @brief two sorted candidates belong to the same group
+static inline int sameGroup(const struct dfile *a, const struct dfile *b)
+{
+  return (a->size == b->size) && (a->d[0] == b->d[0]) && (a->d[1] == b->d[1]);
+}
+
+/// @brief sort the candidates in state DS_NONE, DS_HEAD, or DS_FULL into @a v by digest and
+///        mark those without a partner as DS_UNIQUE
+///
+/// @retval number of candidates in @a v
+static size_t regroup(struct dfile **v)
+{
+  size_t n = 0;
+
+  for (size_t i = 0; i < nfiles; i++) {
+    if (files[i].state <= DS_FULL) v[n++] = &files[i];
+  }
+  qsort(v, n, sizeof(struct dfile*), byDigest);
+
+  for (size_t i = 0; i < n; ) {
+    size_t j = i + 1;
+    while ((j < n) && sameGroup(v[i], v[j])) j++;
+    if (j - i == 1) v[i]->state = DS_UNIQUE;
+    i = j;
+  }
+
+  return n;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// public interface
+//
+
+void dup_add(const char *path, uint64_t size, uint64_t dev, uint64_t ino)
+{
+  if (size == 0) return;
+
+  size_t len = strlen(path) + 1;
+
+  if (nfiles == maxfiles) {
+    maxfiles = maxfiles ? 2*maxfiles : 1024;
+    files = realloc(files, maxfiles * sizeof(struct dfile));
+    if (files == NULL) goto oom;
+  }
+  if (plen + len > pmax) {
+    while (plen + len > pmax) pmax = pmax ? 2*pmax : 64*1024;
+    paths = realloc(paths, pmax);
+    if (paths == NULL) goto oom;
+  }
+
+  struct dfile *f = &files[nfiles++];
+  memset(f, 0, sizeof(*f));
+  f->size  = size;
+  f->dev   = dev;
+  f->ino   = ino;
+  f->path  = plen;
+  f->state = DS_NONE;
+  memcpy(paths + plen, path, len);
+  plen += len;
+
+  return;
+
+oom:
+  fprintf(stderr, "Out of memory.\n");
+  exit(EXIT_FAILURE);
+}
+
+void dup_report(struct pool *p)
+{
+  struct dfile **v = malloc((nfiles ? nfiles : 1) * sizeof(struct dfile*));
+  if (v == NULL) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // stage 1: keep one name per inode and sizes shared by at least two inodes
+  for (size_t i = 0; i < nfiles; i++) v[i] = &files[i];
+  qsort(v, nfiles, sizeof(struct dfile*), byInode);
+  for (size_t i = 0; i < nfiles; ) {
+    size_t j = i + 1, inodes = 1;
+    for (; (j < nfiles) && (v[j]->size == v[i]->size); j++) {
+      if ((v[j]->dev == v[j-1]->dev) && (v[j]->ino == v[j-1]->ino)) v[j]->state = DS_UNIQUE;
+      else inodes++;
+    }
+    if (inodes == 1) v[i]->state = DS_UNIQUE;
+    i = j;
+  }
+
+  // stage 2: hash the heads
+  runStage(p, hashHead, DS_NONE);
+  regroup(v);
+
+  // stage 3: hash the rest of files whose head collides
+  runStage(p, hashRest, DS_HEAD);
+  size_t n = regroup(v);
+
+  // print duplicate sets (largest files first)
+  uint64_t sets = 0, dups = 0, reclaim = 0;
+
+  printf("%-54s\n", "Duplicates");
+  printf("----------------------------------------------------------------------------------------------------\n");
+  for (size_t i = 0; i < n; ) {
+    size_t j = i + 1;
+    while ((j < n) && sameGroup(v[i], v[j])) j++;
+
+    if (v[i]->state == DS_FULL) {
+      printf("%s%" PRIu64 " bytes, %zu copies\n", sets ? "\n" : "", v[i]->size, j - i);
+      for (size_t k = i; k < j; k++) printf("  %s\n", paths + v[k]->path);
+      sets++;
+      dups += j - i - 1;
+      reclaim += (j - i - 1) * v[i]->size;
+    }
+    i = j;
+  }
+  printf("----------------------------------------------------------------------------------------------------\n");
+  printf("%" PRIu64 " duplicate set%s, %" PRIu64 " redundant cop%s, %" PRIu64 " bytes reclaimable\n\n",
+         sets, sets == 1 ? "" : "s", dups, dups == 1 ? "y" : "ies", reclaim);
+
+  free(v);
+}
+
+void dup_free(void)
+{
+  free(files);
+  free(paths);
+  files = NULL;
+  paths = NULL;
+  nfiles = maxfiles = plen = pmax = 0;
+}
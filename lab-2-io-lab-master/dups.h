@@ -0,0 +1,40 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief duplicate file finder
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+#ifndef __DUPS_H__
+#define __DUPS_H__
+
+#include <stdint.h>
+
+#include "pool.h"
+
+/// @brief size of the first stage of hashing (multiple of 32)
+#define DUP_HEAD 4096
+
+/// @brief size of the reads of the second stage (multiple of 32)
+#define DUP_CHUNK (1024*1024)
+
+/// @brief add regular file @a path of @a size bytes to the candidates. Empty files are
+///        ignored. Not thread-safe.
+///
+/// @param path path of the file
+/// @param size size of the file
+/// @param dev device of the file
+/// @param ino inode number of the file
+void dup_add(const char *path, uint64_t size, uint64_t dev, uint64_t ino);
+
+/// @brief find the duplicates among the candidates and print the duplicate sets and a summary
+///
+/// @param p thread pool used for hashing, NULL to hash on the calling thread
+void dup_report(struct pool *p);
+
+/// @brief free the candidates
+void dup_free(void);
+
+#endif // __DUPS_H__
@@ -0,0 +1,249 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief external merge sort for directories that exceed the memory budget
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+// External sort
+// =============
+// A directory is read in parts of about 'limit' bytes of listing (dl_read_limit()). Each part is
+// sorted in memory and written as a run of compact records to an unlinked temporary file in
+// $TMPDIR (default /tmp):
+//
+//   uint64_t ino, uint8_t type, uint16_t len, name[len]
+//
+// The runs are then merged on demand: a min-heap holds one entry per run, ordered by
+// dirent_order(), so the output order is identical to dl_sort(). Memory is bounded by the
+// budget while reading and by one entry plus one stdio buffer per run while merging.
+//
+// Every run is an open file, so the number of runs is bounded: a spilled run has level 0, and
+// whenever the last ES_FANIN runs have the same level, they are merged into one run of the next
+// level (like a counter in base ES_FANIN). At most (ES_FANIN-1) runs per level remain open, and
+// every entry is rewritten once per level, i.e., log_ES_FANIN(number of spills) times.
+//
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "extsort.h"
+
+
+/// @brief open an unlinked temporary file
+///
+/// @retval FILE* on success
+/// @retval NULL on error (errno is set)
+static FILE *es_tmpfile(void)
+{
+  const char *dir = getenv("TMPDIR");
+  char *path;
+
+  if ((dir == NULL) || (dir[0] == '\0')) dir = "/tmp";
+  if (asprintf(&path, "%s/dirtree.XXXXXX", dir) == -1) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  int fd = mkstemp(path);
+  if (fd >= 0) unlink(path);
+  free(path);
+  if (fd < 0) return NULL;
+
+  FILE *f = fdopen(fd, "w+");
+  if (f == NULL) close(fd);
+
+  return f;
+}
+
+/// @brief write an entry record to run file @a f
+static void es_put(FILE *f, uint64_t ino, uint8_t type, uint16_t len, const char *name)
+{
+  fwrite(&ino, sizeof(ino), 1, f);
+  fwrite(&type, sizeof(type), 1, f);
+  fwrite(&len, sizeof(len), 1, f);
+  fwrite(name, 1, len, f);
+}
+
+/// @brief append a new, empty run of level @a level to @a es
+///
+/// @retval FILE* of the run on success
+/// @retval NULL on error (errno is set)
+static FILE *es_newrun(struct extsort *es, unsigned int level)
+{
+  struct esrun *run = realloc(es->run, (es->nrun+1) * sizeof(struct esrun));
+  if (run == NULL) return NULL;
+  es->run = run;
+
+  FILE *f = es_tmpfile();
+  if (f == NULL) return NULL;
+  es->run[es->nrun].f = f;
+  es->run[es->nrun].level = level;
+  es->nrun++;
+
+  return f;
+}
+
+/// @brief sort @a dl and write it as a new run of level 0 of @a es
+///
+/// @retval 0 on success
+/// @retval -1 on error (errno is set)
+static int es_spill(struct extsort *es, struct dirlist *dl)
+{
+  FILE *f = es_newrun(es, 0);
+  if (f == NULL) return -1;
+
+  dl_sort(dl);
+  for (unsigned int i = 0; i < dl->n; i++) {
+    const struct dentry *e = dl_sorted(dl, i);
+    es_put(f, e->ino, e->type, e->len, dl_name(dl, e));
+  }
+
+  if ((fflush(f) != 0) || (fseek(f, 0, SEEK_SET) != 0)) return -1;
+
+  return 0;
+}
+
+/// @brief read the next entry of run @a r into r->e
+///
+/// @retval 1 if an entry was read
+/// @retval 0 at the end of the run
+/// @retval -1 on error
+static int es_read(struct esrun *r)
+{
+  if (fread(&r->e.ino, sizeof(r->e.ino), 1, r->f) != 1) return ferror(r->f) ? -1 : 0;
+  if ((fread(&r->e.type, sizeof(r->e.type), 1, r->f) != 1) ||
+      (fread(&r->e.len, sizeof(r->e.len), 1, r->f) != 1) ||
+      (r->e.len >= sizeof(r->e.name)) ||
+      (fread(r->e.name, 1, r->e.len, r->f) != r->e.len)) {
+    errno = EIO;
+    return -1;
+  }
+  r->e.name[r->e.len] = '\0';
+
+  return 1;
+}
+
+/// @brief heap order: current entry of run @a a sorts before that of run @a b
+static inline int es_less(const struct extsort *es, unsigned int a, unsigned int b)
+{
+  const struct dsent *ea = &es->run[a].e, *eb = &es->run[b].e;
+
+  return dirent_order(ea->type, ea->name, eb->type, eb->name) < 0;
+}
+
+/// @brief restore the heap property below position @a i
+static void es_sift(struct extsort *es, unsigned int i)
+{
+  for (;;) {
+    unsigned int min = i, l = 2*i + 1, r = 2*i + 2;
+
+    if ((l < es->nheap) && es_less(es, es->heap[l], es->heap[min])) min = l;
+    if ((r < es->nheap) && es_less(es, es->heap[r], es->heap[min])) min = r;
+    if (min == i) break;
+
+    unsigned int t = es->heap[i];
+    es->heap[i] = es->heap[min];
+    es->heap[min] = t;
+    i = min;
+  }
+}
+
+/// @brief build the heap of the runs from @a first on, reading their first entries
+///
+/// @retval 0 on success
+/// @retval -1 on error (errno is set)
+static int es_start(struct extsort *es, unsigned int first)
+{
+  free(es->heap);
+  es->nheap = 0;
+  es->heap = malloc((es->nrun > first ? es->nrun - first : 1) * sizeof(unsigned int));
+  if (es->heap == NULL) return -1;
+
+  for (unsigned int i = first; i < es->nrun; i++) {
+    int res = es_read(&es->run[i]);
+    if (res < 0) return -1;
+    if (res > 0) es->heap[es->nheap++] = i;
+  }
+  for (unsigned int i = es->nheap/2; i-- > 0; ) es_sift(es, i);
+
+  return 0;
+}
+
+/// @brief while the last ES_FANIN runs of @a es have the same level, merge them into one run
+///        of the next level
+///
+/// @retval 0 on success
+/// @retval -1 on error (errno is set)
+static int es_compact(struct extsort *es)
+{
+  while (es->nrun >= ES_FANIN) {
+    unsigned int first = es->nrun - ES_FANIN, level = es->run[es->nrun-1].level;
+    if (es->run[first].level != level) break;
+
+    // merge the runs into a new run after them, then move it into the place of the first
+    if (es_start(es, first) < 0) return -1;
+    FILE *f = es_newrun(es, level + 1);
+    if (f == NULL) return -1;
+
+    struct dsent e;
+    int res;
+    while ((res = es_next(es, &e)) > 0) es_put(f, e.ino, e.type, e.len, e.name);
+    if (res < 0) return -1;
+    if ((fflush(f) != 0) || (fseek(f, 0, SEEK_SET) != 0)) return -1;
+
+    for (unsigned int i = first; i < first + ES_FANIN; i++) fclose(es->run[i].f);
+    es->run[first] = es->run[es->nrun-1];
+    es->nrun = first + 1;
+  }
+
+  return 0;
+}
+
+int es_sort(struct extsort *es, struct dirlist *dl, int fd, size_t limit)
+{
+  int more = 1;
+
+  memset(es, 0, sizeof(*es));
+
+  // write runs, merging them to keep the number of open runs bounded
+  while (more) {
+    if ((dl->n > 0) && ((es_spill(es, dl) < 0) || (es_compact(es) < 0))) return -1;
+    more = dl_read_limit(dl, fd, limit);
+    if (more < 0) return -1;
+    if ((more == 0) && (dl->n > 0) && ((es_spill(es, dl) < 0) || (es_compact(es) < 0))) {
+      return -1;
+    }
+  }
+
+  // build heap of the first entries
+  return es_start(es, 0);
+}
+
+int es_next(struct extsort *es, struct dsent *e)
+{
+  if (es->nheap == 0) return 0;
+
+  struct esrun *r = &es->run[es->heap[0]];
+  *e = r->e;
+
+  int res = es_read(r);
+  if (res < 0) return -1;
+  if (res == 0) es->heap[0] = es->heap[--es->nheap];
+  es_sift(es, 0);
+
+  return 1;
+}
+
+void es_free(struct extsort *es)
+{
+  for (unsigned int i = 0; i < es->nrun; i++) fclose(es->run[i].f);
+  free(es->run);
+  free(es->heap);
+  memset(es, 0, sizeof(*es));
+}
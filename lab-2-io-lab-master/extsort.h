@@ -0,0 +1,62 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief external merge sort for directories that exceed the memory budget
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+#ifndef __EXTSORT_H__
+#define __EXTSORT_H__
+
+#include <stdio.h>
+
+#include "dirlist.h"
+
+/// @brief number of runs of the same level that are merged into one run of the next level
+#define ES_FANIN 16
+
+/// @brief sorted run in a temporary file
+struct esrun {
+  FILE *f;                    ///< run file
+  unsigned int level;         ///< number of merges the run went through (0: written by a spill)
+  struct dsent e;             ///< current (smallest unread) entry of the run
+};
+
+/// @brief external sort of one directory
+struct extsort {
+  struct esrun *run;          ///< runs
+  unsigned int nrun;          ///< number of runs
+  unsigned int *heap;         ///< min-heap of runs with entries left (by current entry)
+  unsigned int nheap;         ///< number of runs in heap
+};
+
+/// @brief sort the entries of directory @a fd in the order of dirent_compare() with bounded
+///        memory. @a dl holds the first part of the directory as returned by dl_read_limit()
+///        with limit @a limit; it and the rest of the directory are written to temporary files
+///        as sorted runs of at most about @a limit bytes. @a dl is used as buffer and emptied.
+///        Runs are merged while the directory is read, so at most about ES_FANIN runs per
+///        level are open at a time.
+///
+/// @param es external sort
+/// @param dl first part of the directory (unsorted)
+/// @param fd open directory
+/// @param limit memory budget in bytes
+/// @retval 0 on success
+/// @retval -1 on error (errno is set)
+int es_sort(struct extsort *es, struct dirlist *dl, int fd, size_t limit);
+
+/// @brief return the next entry of @a es in sorted order (k-way merge of the runs)
+///
+/// @param es external sort
+/// @param e receives the entry
+/// @retval 1 if an entry was returned
+/// @retval 0 if all entries have been returned
+/// @retval -1 on error reading a run (errno is set)
+int es_next(struct extsort *es, struct dsent *e);
+
+/// @brief close the runs of @a es and free its memory
+void es_free(struct extsort *es);
+
+#endif // __EXTSORT_H__
@@ -0,0 +1,213 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief thread-safe cache of user and group names
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+// Name cache
+// ==========
+// Resolving a uid or gid through NSS may parse /etc/passwd or ask nscd/sssd, yet most entries of
+// a tree share a handful of owners. Each id is therefore resolved once and kept in an open
+// addressing hash table (linear probing, at most half full) that starts with IDC_INITSIZE slots.
+// The names are copied into a chunked arena and never move, so callers use the returned pointers
+// directly without copying or freeing them.
+//
+// Lookups take the table's read lock. On a miss, the name is resolved without holding the lock
+// and inserted under the write lock; if another thread inserted the id in the meantime, its
+// entry is used.
+//
+
+#define _GNU_SOURCE
+#include <grp.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "idcache.h"
+
+/// @brief size of an arena chunk for names
+#define IDC_CHUNKSIZE 4096
+
+/// @brief cache slot
+struct slot {
+  uint32_t id;                ///< user or group id
+  const char *name;           ///< name, NULL if the slot is empty
+};
+
+/// @brief arena chunk holding names
+struct chunk {
+  struct chunk *next;         ///< next chunk
+  size_t used;                ///< bytes used in data[]
+  size_t size;                ///< capacity of data[]
+  char data[];                ///< names
+};
+
+/// @brief id to name cache
+struct idcache {
+  pthread_rwlock_t lock;      ///< protects all fields
+  struct slot *slot;          ///< hash table
+  unsigned int size;          ///< number of slots (power of two)
+  unsigned int n;             ///< number of used slots
+  struct chunk *arena;        ///< name storage (current chunk first)
+};
+
+static struct idcache users  = { .lock = PTHREAD_RWLOCK_INITIALIZER };   ///< uid cache
+static struct idcache groups = { .lock = PTHREAD_RWLOCK_INITIALIZER };   ///< gid cache
+
+
+/// @brief hash of id @a id
+static inline unsigned int idc_hash(uint32_t id)
+{
+  return id * 2654435761u;
+}
+
+/// @brief find the slot of @a id or the empty slot where it belongs
+static struct slot *idc_find(struct slot *slot, unsigned int size, uint32_t id)
+{
+  unsigned int i = idc_hash(id) & (size-1);
+
+  while ((slot[i].name != NULL) && (slot[i].id != id)) i = (i+1) & (size-1);
+
+  return &slot[i];
+}
+
+/// @brief copy @a name into the arena of cache @a c
+///
+/// @retval const char* copy of @a name
+/// @retval NULL if out of memory
+static const char *idc_store(struct idcache *c, const char *name)
+{
+  size_t len = strlen(name) + 1;
+  struct chunk *ch = c->arena;
+
+  if ((ch == NULL) || (ch->used + len > ch->size)) {
+    size_t size = len > IDC_CHUNKSIZE ? len : IDC_CHUNKSIZE;
+    ch = malloc(sizeof(struct chunk) + size);
+    if (ch == NULL) return NULL;
+    ch->next = c->arena;
+    ch->used = 0;
+    ch->size = size;
+    c->arena = ch;
+  }
+
+  char *s = ch->data + ch->used;
+  memcpy(s, name, len);
+  ch->used += len;
+
+  return s;
+}
+
+/// @brief double the number of slots of cache @a c
+///
+/// @retval 0 on success
+/// @retval -1 if out of memory
+static int idc_grow(struct idcache *c)
+{
+  unsigned int size = c->size ? 2*c->size : IDC_INITSIZE;
+  struct slot *slot = calloc(size, sizeof(struct slot));
+  if (slot == NULL) return -1;
+
+  for (unsigned int i = 0; i < c->size; i++) {
+    if (c->slot[i].name != NULL) *idc_find(slot, size, c->slot[i].id) = c->slot[i];
+  }
+
+  free(c->slot);
+  c->slot = slot;
+  c->size = size;
+
+  return 0;
+}
+
+/// @brief look up @a id in cache @a c, resolving it with @a resolve on a miss
+static const char *idc_lookup(struct idcache *c, uint32_t id,
+                              void (*resolve)(uint32_t id, char *buf, size_t len))
+{
+  const char *name = NULL;
+
+  pthread_rwlock_rdlock(&c->lock);
+  if (c->size > 0) name = idc_find(c->slot, c->size, id)->name;
+  pthread_rwlock_unlock(&c->lock);
+  if (name != NULL) return name;
+
+  // resolve without holding the lock
+  char buf[256];
+  resolve(id, buf, sizeof(buf));
+
+  pthread_rwlock_wrlock(&c->lock);
+  if ((2*(c->n+1) > c->size) && (idc_grow(c) < 0)) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  struct slot *s = idc_find(c->slot, c->size, id);
+  if (s->name == NULL) {
+    s->id = id;
+    s->name = idc_store(c, buf);
+    if (s->name == NULL) {
+      fprintf(stderr, "Out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+    c->n++;
+  }
+  name = s->name;
+  pthread_rwlock_unlock(&c->lock);
+
+  return name;
+}
+
+/// @brief free cache @a c
+static void idc_destroy(struct idcache *c)
+{
+  while (c->arena != NULL) {
+    struct chunk *next = c->arena->next;
+    free(c->arena);
+    c->arena = next;
+  }
+  free(c->slot);
+  c->slot = NULL;
+  c->size = c->n = 0;
+}
+
+/// @brief resolve user name of @a uid into @a buf
+static void resolve_user(uint32_t uid, char *buf, size_t len)
+{
+  char nssbuf[4096];
+  struct passwd pwdbuf, *pwd = NULL;
+
+  getpwuid_r(uid, &pwdbuf, nssbuf, sizeof(nssbuf), &pwd);
+  if (pwd != NULL) snprintf(buf, len, "%s", pwd->pw_name);
+  else snprintf(buf, len, "%d", (int)uid);
+}
+
+/// @brief resolve group name of @a gid into @a buf
+static void resolve_group(uint32_t gid, char *buf, size_t len)
+{
+  char nssbuf[4096];
+  struct group grpbuf, *grp = NULL;
+
+  getgrgid_r(gid, &grpbuf, nssbuf, sizeof(nssbuf), &grp);
+  if (grp != NULL) snprintf(buf, len, "%s", grp->gr_name);
+  else snprintf(buf, len, "%d", (int)gid);
+}
+
+
+const char *idc_user(uid_t uid)
+{
+  return idc_lookup(&users, uid, resolve_user);
+}
+
+const char *idc_group(gid_t gid)
+{
+  return idc_lookup(&groups, gid, resolve_group);
+}
+
+void idc_free(void)
+{
+  idc_destroy(&users);
+  idc_destroy(&groups);
+}
@@ -0,0 +1,35 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief thread-safe cache of user and group names
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+#ifndef __IDCACHE_H__
+#define __IDCACHE_H__
+
+#include <sys/types.h>
+
+/// @brief initial number of slots of each cache (power of two)
+#define IDC_INITSIZE 256
+
+/// @brief name of user @a uid. If the user does not exist, the uid is returned as a decimal
+///        string. The returned string remains valid until idc_free() is called.
+///
+/// @param uid user id
+/// @retval const char* user name
+const char *idc_user(uid_t uid);
+
+/// @brief name of group @a gid. If the group does not exist, the gid is returned as a decimal
+///        string. The returned string remains valid until idc_free() is called.
+///
+/// @param gid group id
+/// @retval const char* group name
+const char *idc_group(gid_t gid);
+
+/// @brief free the caches
+void idc_free(void);
+
+#endif // __IDCACHE_H__
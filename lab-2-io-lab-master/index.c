@@ -0,0 +1,348 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief persisted tree index for incremental re-scans
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+// Tree index
+// ==========
+// Adding or removing an entry updates the mtime of its directory, and changing the directory's
+// own inode updates its ctime. A directory whose device, inode, mtime, and ctime equal those of
+// the previous run therefore has the same entries, and its listing can be taken from the index
+// instead of reading the directory and calling statx on each entry. A re-scan of an unchanged
+// tree costs one open and fstat per directory.
+//
+// Limitation: modifying a file's content, size, or owner does not touch its directory. For such
+// entries, the sizes and owners printed with -v are those of the run that stored the listing.
+//
+// File format:
+// ------------
+// The index is a header followed by one record per directory, in native byte order (an index is
+// meant to be read by the binary that wrote it). All parts are 8-byte aligned:
+//
+//   struct idx_rec  directory identity and the summary of its entries
+//   ent[n]          struct dentry, as in struct dirlist
+//   meta[n]         struct meta (only if IDX_META is set; the optional fields retrieved are
+//                   stored in the record's flags, see meta_init())
+//   idx[n]          sorted order (uint32_t)
+//   names[nlen]     name arena
+//
+// The old index is mapped read-only and its records are found through an open addressing hash
+// table keyed by device and inode; the listings are used in place. Since the traversal indexes
+// them without further checks, every record's sorted order and name offsets are validated when
+// the index is loaded. The new index is written to '<path>.tmp' as the traversal proceeds and
+// renamed over the old one by idx_close().
+//
+// Directories modified during the run are not stored: with coarse timestamps, a change in the
+// same tick as the read would otherwise go unnoticed next time.
+//
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "index.h"
+
+
+#define IDX_MAGIC   "DTINDEX"             ///< file magic
+#define IDX_VERSION 3                     ///< file format version
+#define IDX_META    0x1                   ///< record holds metadata
+#define IDX_FSHIFT  8                     ///< optional metadata fields (META_*) from this bit on
+
+/// @brief round @a x up to a multiple of 8
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+
+/// @brief index file header
+struct idx_hdr {
+  char     magic[8];                      ///< IDX_MAGIC
+  uint32_t version;                       ///< IDX_VERSION
+  uint32_t dsize;                         ///< sizeof(struct dentry)
+  uint32_t msize;                         ///< sizeof(struct meta)
+  uint32_t pad;
+};
+
+/// @brief directory record
+struct idx_rec {
+  uint64_t size;                          ///< size of the record including listing
+  uint64_t dev;                           ///< device of the directory
+  uint64_t ino;                           ///< inode of the directory
+  int64_t  mtime;                         ///< mtime (seconds)
+  int64_t  ctime;                         ///< ctime (seconds)
+  uint32_t mtime_ns;                      ///< mtime (nanoseconds)
+  uint32_t ctime_ns;                      ///< ctime (nanoseconds)
+  uint32_t n;                             ///< number of entries
+  uint32_t flags;                         ///< IDX_*
+  uint64_t nlen;                          ///< size of name arena
+  struct idx_sum sum;                     ///< summary of the entries
+};
+
+static int active = 0;                    ///< index is open
+static char *path = NULL;                 ///< index file
+static char *tmppath = NULL;              ///< new index file
+static FILE *newidx = NULL;               ///< new index
+static pthread_mutex_t newidx_mtx = PTHREAD_MUTEX_INITIALIZER;  ///< protects newidx
+static time_t start;                      ///< start of the run
+
+static char *map = NULL;                  ///< old index
+static size_t maplen = 0;                 ///< size of old index
+static uint64_t *table = NULL;            ///< hash table: record offset + 1, 0 if empty
+static size_t tsize = 0;                  ///< number of slots (power of two)
+
+
+/// @brief hash of directory (@a dev, @a ino)
+static inline size_t idx_hash(uint64_t dev, uint64_t ino)
+{
+  return (ino * 0x9e3779b97f4a7c15ull) ^ (dev * 0xc2b2ae3d27d4eb4full);
+}
+
+/// @brief offsets of the parts of a record with @a n entries
+static void idx_layout(uint32_t n, uint32_t flags, uint64_t *ent, uint64_t *meta, uint64_t *idx,
+                       uint64_t *names)
+{
+  *ent   = ALIGN8(sizeof(struct idx_rec));
+  *meta  = *ent + ALIGN8((uint64_t)n * sizeof(struct dentry));
+  *idx   = *meta + (flags & IDX_META ? ALIGN8((uint64_t)n * sizeof(struct meta)) : 0);
+  *names = *idx + ALIGN8((uint64_t)n * sizeof(uint32_t));
+}
+
+/// @brief check that the listing of record @a r stays within the record: every sorted index is
+///        a valid entry, and every name lies NUL-terminated inside the name arena
+///
+/// @retval 0 if the listing is valid
+/// @retval -1 otherwise
+static int idx_check(const struct idx_rec *r)
+{
+  uint64_t ent, meta, idx, names;
+  idx_layout(r->n, r->flags, &ent, &meta, &idx, &names);
+
+  const struct dentry *e = (const struct dentry*)((const char*)r + ent);
+  const uint32_t *ix = (const uint32_t*)((const char*)r + idx);
+  const char *nm = (const char*)r + names;
+
+  for (uint32_t i = 0; i < r->n; i++) {
+    if (ix[i] >= r->n) return -1;
+    if (((uint64_t)e[i].name + e[i].len >= r->nlen) || (nm[e[i].name + e[i].len] != '\0')) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/// @brief map the old index and build the hash table. An invalid index is ignored.
+static void idx_load(void)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return;
+
+  struct stat sb;
+  if ((fstat(fd, &sb) < 0) || ((size_t)sb.st_size < sizeof(struct idx_hdr))) {
+    close(fd);
+    return;
+  }
+
+  maplen = sb.st_size;
+  map = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    map = NULL;
+    return;
+  }
+
+  const struct idx_hdr *hdr = (const struct idx_hdr*)map;
+  if ((memcmp(hdr->magic, IDX_MAGIC, sizeof(IDX_MAGIC)) != 0) || (hdr->version != IDX_VERSION) ||
+      (hdr->dsize != sizeof(struct dentry)) || (hdr->msize != sizeof(struct meta))) {
+    fprintf(stderr, "Ignoring invalid index '%s'.\n", path);
+    goto invalid;
+  }
+
+  // count and validate records
+  size_t nrec = 0;
+  for (uint64_t pos = ALIGN8(sizeof(struct idx_hdr)); pos < maplen; nrec++) {
+    const struct idx_rec *r = (const struct idx_rec*)(map + pos);
+    uint64_t ent, meta, idx, names;
+
+    if ((maplen - pos < sizeof(struct idx_rec)) || (r->size > maplen - pos) ||
+        (r->nlen > maplen) || (r->n > maplen)) goto corrupt;
+    idx_layout(r->n, r->flags, &ent, &meta, &idx, &names);
+    if ((r->size != ALIGN8(names + r->nlen)) || (idx_check(r) != 0)) goto corrupt;
+
+    pos += r->size;
+  }
+
+  tsize = 16;
+  while (tsize < 2*nrec) tsize *= 2;
+  table = calloc(tsize, sizeof(uint64_t));
+  if (table == NULL) goto invalid;
+
+  for (uint64_t pos = ALIGN8(sizeof(struct idx_hdr)); pos < maplen; ) {
+    const struct idx_rec *r = (const struct idx_rec*)(map + pos);
+    size_t i = idx_hash(r->dev, r->ino) & (tsize-1);
+
+    while (table[i] != 0) i = (i+1) & (tsize-1);
+    table[i] = pos + 1;
+
+    pos += r->size;
+  }
+
+  return;
+
+corrupt:
+  fprintf(stderr, "Ignoring corrupt index '%s'.\n", path);
+invalid:
+  munmap(map, maplen);
+  map = NULL;
+  maplen = 0;
+}
+
+int idx_open(const char *p)
+{
+  path = strdup(p);
+  if ((path == NULL) || (asprintf(&tmppath, "%s.tmp", p) == -1)) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  newidx = fopen(tmppath, "w");
+  if (newidx == NULL) return -1;
+
+  struct idx_hdr hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, IDX_MAGIC, sizeof(IDX_MAGIC));
+  hdr.version = IDX_VERSION;
+  hdr.dsize = sizeof(struct dentry);
+  hdr.msize = sizeof(struct meta);
+  fwrite(&hdr, sizeof(hdr), 1, newidx);
+
+  start = time(NULL);
+  idx_load();
+  active = 1;
+
+  return 0;
+}
+
+int idx_active(void)
+{
+  return active;
+}
+
+int idx_lookup(const struct stat *sb, int need_meta, struct dirlist *dl, const struct meta **m,
+               struct idx_sum *sum)
+{
+  if (table == NULL) return 0;
+
+  size_t i = idx_hash(sb->st_dev, sb->st_ino) & (tsize-1);
+  for (; table[i] != 0; i = (i+1) & (tsize-1)) {
+    const struct idx_rec *r = (const struct idx_rec*)(map + table[i] - 1);
+
+    if ((r->dev != (uint64_t)sb->st_dev) || (r->ino != (uint64_t)sb->st_ino)) continue;
+
+    if ((r->mtime != sb->st_mtim.tv_sec) || (r->mtime_ns != sb->st_mtim.tv_nsec) ||
+        (r->ctime != sb->st_ctim.tv_sec) || (r->ctime_ns != sb->st_ctim.tv_nsec)) return 0;
+    if (need_meta && (!(r->flags & IDX_META) ||
+                      ((r->flags >> IDX_FSHIFT) & meta_fields()) != meta_fields())) return 0;
+
+    uint64_t ent, meta, idx, names;
+    idx_layout(r->n, r->flags, &ent, &meta, &idx, &names);
+
+    dl_init(dl);
+    dl->ent   = (struct dentry*)((char*)r + ent);
+    dl->n     = r->n;
+    dl->idx   = (uint32_t*)((char*)r + idx);
+    dl->names = (char*)r + names;
+    dl->nlen  = r->nlen;
+    *m = r->flags & IDX_META ? (const struct meta*)((char*)r + meta) : NULL;
+    if (sum != NULL) *sum = r->sum;
+
+    return 1;
+  }
+
+  return 0;
+}
+
+/// @brief write @a len bytes at @a p followed by padding to a multiple of 8 bytes
+static void idx_write(const void *p, size_t len)
+{
+  static const char zero[8];
+
+  fwrite(p, 1, len, newidx);
+  fwrite(zero, 1, ALIGN8(len) - len, newidx);
+}
+
+void idx_store(const struct stat *sb, const struct dirlist *dl, const struct meta *m)
+{
+  // skip directories modified during the run (see above)
+  if ((sb->st_mtim.tv_sec >= start) || (sb->st_ctim.tv_sec >= start)) return;
+
+  struct idx_rec r;
+  uint64_t ent, meta, idx, names;
+
+  memset(&r, 0, sizeof(r));
+  r.dev      = sb->st_dev;
+  r.ino      = sb->st_ino;
+  r.mtime    = sb->st_mtim.tv_sec;
+  r.mtime_ns = sb->st_mtim.tv_nsec;
+  r.ctime    = sb->st_ctim.tv_sec;
+  r.ctime_ns = sb->st_ctim.tv_nsec;
+  r.n        = dl->n;
+  r.flags    = (m != NULL) || (dl->n == 0) ? IDX_META | meta_fields() << IDX_FSHIFT : 0;
+  r.nlen     = dl->nlen;
+
+  idx_layout(r.n, r.flags, &ent, &meta, &idx, &names);
+  r.size = ALIGN8(names + r.nlen);
+
+  for (unsigned int i = 0; i < dl->n; i++) {
+    switch (dl->ent[i].type) {
+      case DT_REG:  r.sum.files++; break;
+      case DT_DIR:  r.sum.dirs++;  break;
+      case DT_LNK:  r.sum.links++; break;
+      case DT_FIFO: r.sum.fifos++; break;
+      case DT_SOCK: r.sum.socks++; break;
+      default: ;
+    }
+    if ((m != NULL) && (m[i].err == 0)) {
+      r.sum.size   += m[i].size;
+      r.sum.blocks += m[i].blocks;
+    }
+  }
+
+  pthread_mutex_lock(&newidx_mtx);
+  idx_write(&r, sizeof(r));
+  idx_write(dl->ent, dl->n * sizeof(struct dentry));
+  if (m != NULL) idx_write(m, dl->n * sizeof(struct meta));
+  idx_write(dl->idx, dl->n * sizeof(uint32_t));
+  idx_write(dl->names, dl->nlen);
+  pthread_mutex_unlock(&newidx_mtx);
+}
+
+void idx_close(void)
+{
+  if (!active) return;
+
+  if (fclose(newidx) != 0) {
+    perror(tmppath);
+    unlink(tmppath);
+  } else if (rename(tmppath, path) < 0) {
+    perror(path);
+  }
+  newidx = NULL;
+
+  if (map != NULL) munmap(map, maplen);
+  map = NULL;
+  free(table);
+  table = NULL;
+  free(path);
+  free(tmppath);
+  active = 0;
+}
@@ -0,0 +1,66 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief persisted tree index for incremental re-scans
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+#ifndef __INDEX_H__
+#define __INDEX_H__
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "dirlist.h"
+#include "meta.h"
+
+/// @brief summary of the entries of one directory as stored in the index
+struct idx_sum {
+  uint64_t dirs;              ///< number of directories
+  uint64_t files;             ///< number of files
+  uint64_t links;             ///< number of links
+  uint64_t fifos;             ///< number of pipes
+  uint64_t socks;             ///< number of sockets
+  uint64_t size;              ///< total size (only if metadata is stored)
+  uint64_t blocks;            ///< total number of blocks (only if metadata is stored)
+};
+
+/// @brief open index file @a path. The directories it holds are available through
+///        idx_lookup(); a new index is collected with idx_store() and replaces the old one when
+///        idx_close() is called. A missing or invalid index file is treated as empty.
+///
+/// @param path index file
+/// @retval 0 on success
+/// @retval -1 if the new index cannot be created (errno is set)
+int idx_open(const char *path);
+
+/// @brief check whether an index is open
+int idx_active(void);
+
+/// @brief look up the listing of directory @a sb in the old index. A directory is found if its
+///        device, inode, mtime, and ctime match the stored ones and, with @a need_meta, its
+///        stored metadata includes the optional fields of this run (see meta_init()).
+///
+/// @param sb status of the directory
+/// @param need_meta the caller needs the metadata of the entries
+/// @param dl receives a read-only, sorted listing pointing into the index (do not dl_free() it)
+/// @param m receives the metadata of the entries (if stored) or NULL
+/// @param sum receives the summary of the directory's entries (may be NULL)
+/// @retval 1 if the directory was found
+/// @retval 0 otherwise
+int idx_lookup(const struct stat *sb, int need_meta, struct dirlist *dl, const struct meta **m,
+               struct idx_sum *sum);
+
+/// @brief add the sorted listing @a dl of directory @a sb to the new index. Thread-safe.
+///
+/// @param sb status of the directory
+/// @param dl sorted listing
+/// @param m metadata of the entries or NULL
+void idx_store(const struct stat *sb, const struct dirlist *dl, const struct meta *m);
+
+/// @brief replace the old index by the new one and close it
+void idx_close(void);
+
+#endif // __INDEX_H__
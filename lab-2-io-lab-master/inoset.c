@@ -0,0 +1,141 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief sharded set of inodes for hard-link-aware accounting
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+// Inode set
+// =========
+// With -u, a file with more than one link is counted only under the first name found; its other
+// names add nothing to the totals. The set remembers the (device, inode) pairs of such files.
+// Files with a single link cannot be seen twice and are never added, so the set stays small even
+// for large trees.
+//
+// The set is split into INO_SHARDS shards selected by the upper bits of the hash, each an open
+// addressing hash table (linear probing, at most half full) of 16-byte keys under its own mutex.
+// Workers of the parallel mode thus rarely wait for each other. Inode 0 is not used by Linux file
+// systems and marks an empty slot.
+//
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inoset.h"
+
+/// @brief set slot
+struct ikey {
+  uint64_t ino;               ///< inode number, 0 if the slot is empty
+  uint64_t dev;               ///< device
+};
+
+/// @brief shard of the set
+struct shard {
+  pthread_mutex_t lock;       ///< protects all fields
+  struct ikey *slot;          ///< hash table
+  size_t size;                ///< number of slots (power of two), 0 before first use
+  size_t n;                   ///< number of used slots
+};
+
+static struct shard shards[INO_SHARDS] = {
+  [0 ... INO_SHARDS-1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};                            ///< shards of the set
+
+
+/// @brief hash of inode (@a dev, @a ino)
+static inline uint64_t ino_hash(uint64_t dev, uint64_t ino)
+{
+  uint64_t h = (ino ^ (dev * 0xc2b2ae3d27d4eb4full)) * 0x9e3779b97f4a7c15ull;
+
+  return h ^ (h >> 29);
+}
+
+/// @brief find the slot of (@a dev, @a ino) or the empty slot where it belongs
+static struct ikey *ino_find(struct ikey *slot, size_t size, uint64_t h, uint64_t dev,
+                             uint64_t ino)
+{
+  size_t i = h & (size-1);
+
+  while ((slot[i].ino != 0) && ((slot[i].ino != ino) || (slot[i].dev != dev))) {
+    i = (i+1) & (size-1);
+  }
+
+  return &slot[i];
+}
+
+/// @brief double the number of slots of shard @a s
+///
+/// @retval 0 on success
+/// @retval -1 if out of memory
+static int ino_grow(struct shard *s)
+{
+  size_t size = s->size ? 2*s->size : INO_INITSIZE;
+  struct ikey *slot = calloc(size, sizeof(struct ikey));
+  if (slot == NULL) return -1;
+
+  for (size_t i = 0; i < s->size; i++) {
+    if (s->slot[i].ino == 0) continue;
+    *ino_find(slot, size, ino_hash(s->slot[i].dev, s->slot[i].ino), s->slot[i].dev,
+              s->slot[i].ino) = s->slot[i];
+  }
+
+  free(s->slot);
+  s->slot = slot;
+  s->size = size;
+
+  return 0;
+}
+
+int ino_add(uint64_t dev, uint64_t ino)
+{
+  if (ino == 0) return 1;
+
+  uint64_t h = ino_hash(dev, ino);
+  struct shard *s = &shards[h >> 58 & (INO_SHARDS-1)];
+  int res = 1;
+
+  pthread_mutex_lock(&s->lock);
+  if ((2*(s->n+1) > s->size) && (ino_grow(s) < 0)) {
+    // out of memory: count the inode rather than losing it
+    pthread_mutex_unlock(&s->lock);
+    return 1;
+  }
+
+  struct ikey *k = ino_find(s->slot, s->size, h, dev, ino);
+  if (k->ino != 0) res = 0;
+  else {
+    k->ino = ino;
+    k->dev = dev;
+    s->n++;
+  }
+  pthread_mutex_unlock(&s->lock);
+
+  return res;
+}
+
+size_t ino_memory(void)
+{
+  size_t mem = 0;
+
+  for (int i = 0; i < INO_SHARDS; i++) {
+    pthread_mutex_lock(&shards[i].lock);
+    mem += shards[i].size * sizeof(struct ikey);
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+
+  return mem;
+}
+
+void ino_free(void)
+{
+  for (int i = 0; i < INO_SHARDS; i++) {
+    pthread_mutex_lock(&shards[i].lock);
+    free(shards[i].slot);
+    shards[i].slot = NULL;
+    shards[i].size = shards[i].n = 0;
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+}
@@ -0,0 +1,36 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief sharded set of inodes for hard-link-aware accounting
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+#ifndef __INOSET_H__
+#define __INOSET_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief number of shards (power of two)
+#define INO_SHARDS 64
+
+/// @brief initial number of slots of a shard (power of two)
+#define INO_INITSIZE 64
+
+/// @brief add inode (@a dev, @a ino) to the set. Thread-safe.
+///
+/// @param dev device of the inode
+/// @param ino inode number
+/// @retval 1 if the inode was not in the set (or cannot be added)
+/// @retval 0 if the inode has been added before
+int ino_add(uint64_t dev, uint64_t ino);
+
+/// @brief memory used by the set in bytes
+size_t ino_memory(void);
+
+/// @brief empty the set and free its memory
+void ino_free(void);
+
+#endif // __INOSET_H__
@@ -0,0 +1,76 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief batched metadata retrieval with statx and io_uring
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+#ifndef __META_H__
+#define __META_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dirlist.h"
+
+/// @brief maximum number of statx requests in flight per directory
+#define META_MAX_INFLIGHT 4096
+
+/// @name optional fields (meta_init()). Size, blocks, device, owner, and mode are always retrieved.
+/// @{
+#define META_INODE  0x1       ///< inode number and link count (-u, --dups, --snapshot)
+#define META_MTIME  0x2       ///< modification time (--snapshot)
+/// @}
+
+/// @brief metadata of a directory entry as needed by the output
+struct meta {
+  uint64_t size;              ///< size in bytes
+  uint64_t blocks;            ///< number of 512-byte blocks
+  uint64_t dev;               ///< device
+  uint64_t ino;               ///< inode number (META_INODE, 0 otherwise)
+  int64_t  mtime;             ///< modification time in seconds (META_MTIME, 0 otherwise)
+  uint32_t mtime_ns;          ///< modification time in nanoseconds (META_MTIME, 0 otherwise)
+  uid_t    uid;               ///< owner
+  gid_t    gid;               ///< group
+  mode_t   mode;              ///< file type and mode
+  uint32_t nlink;             ///< number of hard links (META_INODE, 0 otherwise)
+  int      err;               ///< 0 if the fields are valid, errno of the failed statx otherwise
+};
+
+/// @brief configure the metadata stage. With @a inflight > 0, statx requests are submitted
+///        through io_uring with up to @a inflight requests in flight per directory; with 0 (the
+///        default) or if io_uring is not available, statx is called synchronously. statx is
+///        asked only for the optional fields in @a fields.
+///
+/// @param inflight number of requests in flight (0..META_MAX_INFLIGHT)
+/// @param fields optional fields to retrieve (META_*)
+void meta_init(int inflight, unsigned int fields);
+
+/// @brief return the optional fields retrieved (META_*, see meta_init())
+unsigned int meta_fields(void);
+
+/// @brief retrieve the metadata of all entries of listing @a dl in directory @a fd. Symbolic
+///        links are not followed.
+///
+/// @param fd open directory
+/// @param dl listing of @a fd
+/// @param m array of dl->n elements receiving the metadata of dl->ent[i] in m[i]
+void meta_fetch(int fd, const struct dirlist *dl, struct meta *m);
+
+/// @brief retrieve the metadata of entry @a name in directory @a fd with a synchronous statx.
+///        Symbolic links are not followed.
+///
+/// @param fd open directory
+/// @param name entry name
+/// @param m receives the metadata
+void meta_stat(int fd, const char *name, struct meta *m);
+
+/// @brief check whether io_uring is used
+///
+/// @retval 1 if requests are submitted through io_uring
+/// @retval 0 if statx is called synchronously
+int meta_uring(void);
+
+#endif // __META_H__
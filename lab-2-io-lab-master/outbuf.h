@@ -0,0 +1,96 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief allocation-free output buffer with fixed-width formatting
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+#ifndef __OUTBUF_H__
+#define __OUTBUF_H__
+
+#include <stddef.h>
+#include <string.h>
+
+/// @brief initial capacity of an output buffer
+#define OB_SIZE (128*1024)
+
+/// @brief a buffer attached to a file descriptor is written out when it holds this many bytes
+#define OB_FLUSH (64*1024)
+
+/// @brief output buffer
+struct outbuf {
+  char   *buf;                ///< buffer
+  size_t len;                 ///< number of bytes in buf
+  size_t max;                 ///< capacity of buf
+  int    fd;                  ///< file descriptor written to, or -1 to keep everything in memory
+};
+
+/// @brief initialize buffer @a ob. With @a fd >= 0, the content is written to @a fd in chunks of
+///        at least OB_FLUSH bytes; with @a fd = -1, it grows as needed and is kept in memory.
+void ob_init(struct outbuf *ob, int fd);
+
+/// @brief free the memory of buffer @a ob (without flushing it)
+void ob_free(struct outbuf *ob);
+
+/// @brief write the content of @a ob to its file descriptor
+void ob_flush(struct outbuf *ob);
+
+/// @brief make room for @a len more bytes in @a ob (flushes or grows the buffer). Aborts the
+///        program if out of memory.
+void ob_reserve(struct outbuf *ob, size_t len);
+
+/// @brief append @a len bytes at @a s to @a ob. Large blocks bypass the buffer of a buffer
+///        attached to a file descriptor.
+void ob_write(struct outbuf *ob, const char *s, size_t len);
+
+/// @brief append @a v as a decimal number right-aligned in a field of @a width characters
+void ob_num(struct outbuf *ob, long v, int width);
+
+/// @brief append @a n bytes at @a s to @a ob
+static inline void ob_put(struct outbuf *ob, const char *s, size_t n)
+{
+  if (ob->len + n > ob->max) ob_reserve(ob, n);
+  memcpy(ob->buf + ob->len, s, n);
+  ob->len += n;
+}
+
+/// @brief append string @a s to @a ob
+static inline void ob_puts(struct outbuf *ob, const char *s)
+{
+  ob_put(ob, s, strlen(s));
+}
+
+/// @brief append character @a c to @a ob
+static inline void ob_putc(struct outbuf *ob, char c)
+{
+  if (ob->len + 1 > ob->max) ob_reserve(ob, 1);
+  ob->buf[ob->len++] = c;
+}
+
+/// @brief append @a n spaces to @a ob
+static inline void ob_pad(struct outbuf *ob, size_t n)
+{
+  if (ob->len + n > ob->max) ob_reserve(ob, n);
+  memset(ob->buf + ob->len, ' ', n);
+  ob->len += n;
+}
+
+/// @brief append string @a s right-aligned in a field of @a width characters (like "%*s")
+static inline void ob_right(struct outbuf *ob, const char *s, size_t width)
+{
+  size_t n = strlen(s);
+  if (n < width) ob_pad(ob, width - n);
+  ob_put(ob, s, n);
+}
+
+/// @brief append string @a s left-aligned in a field of @a width characters (like "%-*s")
+static inline void ob_left(struct outbuf *ob, const char *s, size_t width)
+{
+  size_t n = strlen(s);
+  ob_put(ob, s, n);
+  if (n < width) ob_pad(ob, width - n);
+}
+
+#endif // __OUTBUF_H__
@@ -0,0 +1,250 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief work-stealing thread pool
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+// Work-stealing thread pool
+// =========================
+// Every worker owns a double-ended queue of tasks. A worker pushes the tasks it submits onto the
+// bottom of its own queue and also takes its next task from there (LIFO), so a traversal stays
+// depth-first and cache-friendly per thread. When its queue is empty, a worker steals the oldest
+// task from the top of another worker's queue (FIFO); old tasks tend to be large subtrees.
+//
+// The queues are short critical sections protected by one mutex each. Two counters are kept
+// with atomic operations:
+//   queued   tasks sitting in a queue. Idle workers sleep on 'work' while it is zero.
+//   pending  tasks submitted but not yet completed. pool_wait() sleeps on 'done' until it is zero.
+// Submitters increment 'queued' before they take the pool mutex to wake a sleeper, and sleepers
+// check 'queued' while holding the mutex, so wake-ups cannot get lost.
+//
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+
+/// @brief task
+struct task {
+  pool_fn fn;                           ///< task function
+  void    *arg;                         ///< argument
+};
+
+/// @brief task queue of one worker (ring buffer)
+struct deque {
+  pthread_mutex_t mtx;                  ///< protects the queue
+  struct task     *task;                ///< ring buffer
+  unsigned int    size;                 ///< capacity (power of 2)
+  unsigned int    top;                  ///< index of oldest task (steal end)
+  unsigned int    bottom;               ///< index after newest task (owner end)
+};
+
+/// @brief thread pool
+struct pool {
+  int             nthreads;             ///< number of workers
+  pthread_t       *tid;                 ///< worker threads
+  struct deque    *dq;                  ///< one queue per worker
+
+  pthread_mutex_t mtx;                  ///< protects sleeping and shutdown
+  pthread_cond_t  work;                 ///< signaled when tasks are queued or on shutdown
+  pthread_cond_t  done;                 ///< signaled when pending drops to zero
+  int             sleepers;             ///< number of workers waiting on 'work'
+  int             shutdown;             ///< terminate workers
+  unsigned long   queued;               ///< tasks in the queues (atomic)
+  unsigned long   pending;              ///< tasks not yet completed (atomic)
+  unsigned int    next;                 ///< round-robin queue for external submissions (atomic)
+};
+
+/// @brief worker argument
+struct worker {
+  struct pool *p;                       ///< pool
+  int         id;                       ///< worker index
+};
+
+static __thread int self = -1;          ///< index of the calling worker thread
+
+
+/// @brief push task @a t onto the bottom of queue @a d
+static void dq_push(struct deque *d, struct task t)
+{
+  pthread_mutex_lock(&d->mtx);
+
+  if (d->bottom - d->top == d->size) {
+    // full: double the ring buffer and unwrap it
+    unsigned int nsize = d->size ? 2*d->size : 64;
+    struct task *ntask = malloc(nsize * sizeof(struct task));
+    if (ntask == NULL) abort();
+
+    for (unsigned int i = d->top; i != d->bottom; i++) {
+      ntask[i - d->top] = d->task[i & (d->size-1)];
+    }
+    free(d->task);
+    d->task = ntask;
+    d->bottom -= d->top;
+    d->top = 0;
+    d->size = nsize;
+  }
+
+  d->task[d->bottom++ & (d->size-1)] = t;
+
+  pthread_mutex_unlock(&d->mtx);
+}
+
+/// @brief take a task from queue @a d: the newest task if @a steal is zero, the oldest otherwise
+///
+/// @retval 1 if a task was taken and stored in @a t
+/// @retval 0 if the queue was empty
+static int dq_take(struct deque *d, struct task *t, int steal)
+{
+  int res = 0;
+
+  pthread_mutex_lock(&d->mtx);
+  if (d->bottom != d->top) {
+    if (steal) *t = d->task[d->top++ & (d->size-1)];
+    else       *t = d->task[--d->bottom & (d->size-1)];
+    res = 1;
+  }
+  pthread_mutex_unlock(&d->mtx);
+
+  return res;
+}
+
+/// @brief find a task for worker @a id: own queue first, then steal from the others
+static int find_task(struct pool *p, int id, struct task *t)
+{
+  if (dq_take(&p->dq[id], t, 0)) return 1;
+
+  for (int i = 1; i < p->nthreads; i++) {
+    if (dq_take(&p->dq[(id + i) % p->nthreads], t, 1)) return 1;
+  }
+
+  return 0;
+}
+
+/// @brief worker thread main loop
+static void *worker_main(void *arg)
+{
+  struct worker *w = arg;
+  struct pool *p = w->p;
+  struct task t;
+
+  self = w->id;
+  free(w);
+
+  for (;;) {
+    if (find_task(p, self, &t)) {
+      __atomic_sub_fetch(&p->queued, 1, __ATOMIC_SEQ_CST);
+
+      t.fn(t.arg);
+
+      if (__atomic_sub_fetch(&p->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+        pthread_mutex_lock(&p->mtx);
+        pthread_cond_broadcast(&p->done);
+        pthread_mutex_unlock(&p->mtx);
+      }
+      continue;
+    }
+
+    pthread_mutex_lock(&p->mtx);
+    if (p->shutdown) {
+      pthread_mutex_unlock(&p->mtx);
+      break;
+    }
+    if (__atomic_load_n(&p->queued, __ATOMIC_SEQ_CST) == 0) {
+      p->sleepers++;
+      pthread_cond_wait(&p->work, &p->mtx);
+      p->sleepers--;
+    }
+    pthread_mutex_unlock(&p->mtx);
+  }
+
+  return NULL;
+}
+
+
+struct pool *pool_create(int nthreads)
+{
+  if ((nthreads < 1) || (nthreads > POOL_MAX_THREADS)) return NULL;
+
+  struct pool *p = calloc(1, sizeof(struct pool));
+  if (p == NULL) return NULL;
+
+  p->nthreads = nthreads;
+  p->tid = calloc(nthreads, sizeof(pthread_t));
+  p->dq = calloc(nthreads, sizeof(struct deque));
+  if ((p->tid == NULL) || (p->dq == NULL)) {
+    free(p->tid);
+    free(p->dq);
+    free(p);
+    return NULL;
+  }
+
+  pthread_mutex_init(&p->mtx, NULL);
+  pthread_cond_init(&p->work, NULL);
+  pthread_cond_init(&p->done, NULL);
+  for (int i = 0; i < nthreads; i++) pthread_mutex_init(&p->dq[i].mtx, NULL);
+
+  for (int i = 0; i < nthreads; i++) {
+    struct worker *w = malloc(sizeof(struct worker));
+    if (w == NULL) abort();
+    w->p = p;
+    w->id = i;
+    if (pthread_create(&p->tid[i], NULL, worker_main, w) != 0) abort();
+  }
+
+  return p;
+}
+
+void pool_submit(struct pool *p, pool_fn fn, void *arg)
+{
+  struct task t = { fn, arg };
+  int q = self >= 0 ? self : (int)(__atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED) % p->nthreads);
+
+  __atomic_add_fetch(&p->pending, 1, __ATOMIC_SEQ_CST);
+  dq_push(&p->dq[q], t);
+  __atomic_add_fetch(&p->queued, 1, __ATOMIC_SEQ_CST);
+
+  pthread_mutex_lock(&p->mtx);
+  if (p->sleepers > 0) pthread_cond_signal(&p->work);
+  pthread_mutex_unlock(&p->mtx);
+}
+
+void pool_wait(struct pool *p)
+{
+  pthread_mutex_lock(&p->mtx);
+  while (__atomic_load_n(&p->pending, __ATOMIC_SEQ_CST) > 0) pthread_cond_wait(&p->done, &p->mtx);
+  pthread_mutex_unlock(&p->mtx);
+}
+
+void pool_destroy(struct pool *p)
+{
+  pool_wait(p);
+
+  pthread_mutex_lock(&p->mtx);
+  p->shutdown = 1;
+  pthread_cond_broadcast(&p->work);
+  pthread_mutex_unlock(&p->mtx);
+
+  for (int i = 0; i < p->nthreads; i++) pthread_join(p->tid[i], NULL);
+
+  for (int i = 0; i < p->nthreads; i++) {
+    pthread_mutex_destroy(&p->dq[i].mtx);
+    free(p->dq[i].task);
+  }
+  pthread_mutex_destroy(&p->mtx);
+  pthread_cond_destroy(&p->work);
+  pthread_cond_destroy(&p->done);
+  free(p->dq);
+  free(p->tid);
+  free(p);
+}
+
+int pool_self(void)
+{
+  return self;
+}
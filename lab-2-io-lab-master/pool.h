@@ -0,0 +1,53 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief work-stealing thread pool
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+/// @brief maximum number of worker threads
+#define POOL_MAX_THREADS 256
+
+/// @brief task function
+typedef void (*pool_fn)(void *arg);
+
+/// @brief opaque thread pool
+struct pool;
+
+/// @brief create a pool with @a nthreads worker threads
+///
+/// @param nthreads number of worker threads (1..POOL_MAX_THREADS)
+/// @retval struct pool* on success
+/// @retval NULL on error
+struct pool *pool_create(int nthreads);
+
+/// @brief submit task @a fn(@a arg). Tasks submitted by a worker are pushed onto that worker's own
+///        queue; tasks submitted by other threads are distributed round-robin.
+///
+/// @param p pool
+/// @param fn task function
+/// @param arg argument passed to @a fn
+void pool_submit(struct pool *p, pool_fn fn, void *arg);
+
+/// @brief wait until all submitted tasks (including tasks submitted by tasks) have completed
+///
+/// @param p pool
+void pool_wait(struct pool *p);
+
+/// @brief wait for all tasks, terminate the worker threads, and free the pool
+///
+/// @param p pool
+void pool_destroy(struct pool *p);
+
+/// @brief index of the calling worker thread
+///
+/// @retval 0..nthreads-1 if called from a worker thread
+/// @retval -1 otherwise
+int pool_self(void);
+
+#endif // __POOL_H__
@@ -0,0 +1,358 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief tree snapshots and streaming snapshot diff
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+// Snapshots
+// =========
+// A snapshot (--snapshot) records the entries of one or more trees in the order of a sorted
+// depth-first traversal: every directory is followed by its subtree, and the entries of a
+// directory are in the order of dl_sort(). Paths are not stored; each record holds the depth
+// and the name of its entry, and the path follows from the names of the last records on the
+// lower levels. The file is a header followed by packed records in native byte order:
+//
+//   uint64_t size, uint64_t ino, int64_t mtime, uint32_t mtime_ns,
+//   uint16_t depth, uint8_t type, uint8_t err, uint16_t len, name[len]
+//
+// A record of depth 0 starts a tree; its name is the root directory as given.
+//
+// Diff:
+// -----
+// Because of this order, two snapshots are compared in one pass like two sorted lists
+// (merge-join). Entries compare by their paths, level by level in the order of dirent_order();
+// the trees of the two snapshots are paired in the order of their roots. An entry found only in
+// the old snapshot was removed, one found only in the new snapshot was added, and an entry in
+// both was modified if its type, size, mtime, or inode changed. Directories are reported only
+// when added or removed, since their mtime and size follow from their entries.
+// A reader keeps the names on the path of its current record, so memory use depends on the
+// depth of the trees only.
+//
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dirlist.h"
+#include "snapshot.h"
+
+#define SNAP_MAGIC   "DTSNAP"             ///< file magic
+#define SNAP_VERSION 1                    ///< file format version
+#define SNAP_BUFSIZE (1024*1024)          ///< stdio buffer size
+
+/// @brief snapshot file header
+struct snap_hdr {
+  char     magic[8];                      ///< SNAP_MAGIC
+  uint32_t version;                       ///< SNAP_VERSION
+  uint32_t pad;
+};
+
+/// @brief snapshot record (without name)
+struct snap_rec {
+  uint64_t size;                          ///< size
+  uint64_t ino;                           ///< inode number
+  int64_t  mtime;                         ///< modification time (seconds)
+  uint32_t mtime_ns;                      ///< modification time (nanoseconds)
+  uint16_t depth;                         ///< depth (0: root directory)
+  uint8_t  type;                          ///< file type (DT_*)
+  uint8_t  err;                           ///< metadata not available
+  uint16_t len;                           ///< length of the name
+};
+
+/// @brief path component of a reader
+struct comp {
+  unsigned char type;                     ///< file type (DT_*)
+  char *name;                             ///< name
+  size_t max;                             ///< capacity of name
+};
+
+/// @brief snapshot reader
+struct snapcur {
+  const char *file;                       ///< snapshot file
+  FILE *f;                                ///< open snapshot
+  int end;                                ///< all records read
+  unsigned int root;                      ///< number of the current tree
+  struct snap_rec r;                      ///< current record
+  struct comp *comp;                      ///< names on the path of the current record
+  unsigned int maxcomp;                   ///< capacity of comp[]
+};
+
+static FILE *snap = NULL;                 ///< snapshot being written
+static char *snapbuf = NULL;              ///< stdio buffer of snap
+
+
+//--------------------------------------------------------------------------------------------------
+// writing
+//
+
+/// @brief write record @a r with name @a name to the snapshot
+static void snap_write(const struct snap_rec *r, const char *name)
+{
+  fwrite(&r->size, sizeof(r->size), 1, snap);
+  fwrite(&r->ino, sizeof(r->ino), 1, snap);
+  fwrite(&r->mtime, sizeof(r->mtime), 1, snap);
+  fwrite(&r->mtime_ns, sizeof(r->mtime_ns), 1, snap);
+  fwrite(&r->depth, sizeof(r->depth), 1, snap);
+  fwrite(&r->type, sizeof(r->type), 1, snap);
+  fwrite(&r->err, sizeof(r->err), 1, snap);
+  fwrite(&r->len, sizeof(r->len), 1, snap);
+  fwrite(name, 1, r->len, snap);
+}
+
+int snap_create(const char *path)
+{
+  snap = fopen(path, "w");
+  if (snap == NULL) return -1;
+
+  snapbuf = malloc(SNAP_BUFSIZE);
+  if (snapbuf != NULL) setvbuf(snap, snapbuf, _IOFBF, SNAP_BUFSIZE);
+
+  struct snap_hdr hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, SNAP_MAGIC, sizeof(SNAP_MAGIC));
+  hdr.version = SNAP_VERSION;
+  fwrite(&hdr, sizeof(hdr), 1, snap);
+
+  return 0;
+}
+
+void snap_root(const char *dn)
+{
+  struct snap_rec r;
+  size_t len = strlen(dn);
+
+  memset(&r, 0, sizeof(r));
+  r.type = DT_DIR;
+  r.len = len < UINT16_MAX ? len : UINT16_MAX;
+  snap_write(&r, dn);
+}
+
+void snap_add(unsigned int depth, const char *name, size_t len, unsigned char type,
+              const struct meta *m)
+{
+  struct snap_rec r;
+
+  // deeper entries cannot be encoded
+  if (depth > UINT16_MAX) return;
+
+  memset(&r, 0, sizeof(r));
+  r.depth = depth;
+  r.type  = type;
+  r.len   = len;
+  r.err   = (m == NULL) || (m->err != 0);
+  if (!r.err) {
+    r.size     = m->size;
+    r.ino      = m->ino;
+    r.mtime    = m->mtime;
+    r.mtime_ns = m->mtime_ns;
+  }
+  snap_write(&r, name);
+}
+
+int snap_close(void)
+{
+  int res = fclose(snap);
+
+  snap = NULL;
+  free(snapbuf);
+  snapbuf = NULL;
+
+  return res == 0 ? 0 : -1;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// diff
+//
+
+/// @brief read the next record of reader @a c
+///
+/// @retval 0 on success or at the end of the snapshot (c->end is set)
+/// @retval -1 if the snapshot is corrupt (an error has been printed)
+static int snap_next(struct snapcur *c)
+{
+  struct snap_rec *r = &c->r;
+  unsigned int prev = c->r.depth;
+
+  if (fread(&r->size, sizeof(r->size), 1, c->f) != 1) {
+    if (ferror(c->f)) goto corrupt;
+    c->end = 1;
+    c->root = UINT_MAX;
+    return 0;
+  }
+  if ((fread(&r->ino, sizeof(r->ino), 1, c->f) != 1) ||
+      (fread(&r->mtime, sizeof(r->mtime), 1, c->f) != 1) ||
+      (fread(&r->mtime_ns, sizeof(r->mtime_ns), 1, c->f) != 1) ||
+      (fread(&r->depth, sizeof(r->depth), 1, c->f) != 1) ||
+      (fread(&r->type, sizeof(r->type), 1, c->f) != 1) ||
+      (fread(&r->err, sizeof(r->err), 1, c->f) != 1) ||
+      (fread(&r->len, sizeof(r->len), 1, c->f) != 1)) goto corrupt;
+
+  // a record is at most one level below the previous one; the first one starts a tree
+  if ((r->depth > prev + 1) || ((c->root == 0) && (r->depth != 0))) goto corrupt;
+  if (r->depth == 0) c->root++;
+
+  if (r->depth >= c->maxcomp) {
+    unsigned int max = 2*c->maxcomp > r->depth ? 2*c->maxcomp : r->depth + 1;
+    struct comp *comp = realloc(c->comp, max * sizeof(struct comp));
+    if (comp == NULL) {
+      errno = ENOMEM;
+      goto error;
+    }
+    memset(comp + c->maxcomp, 0, (max - c->maxcomp) * sizeof(struct comp));
+    c->comp = comp;
+    c->maxcomp = max;
+  }
+
+  struct comp *p = &c->comp[r->depth];
+  if (r->len + 1u > p->max) {
+    char *name = realloc(p->name, r->len + 1);
+    if (name == NULL) {
+      errno = ENOMEM;
+      goto error;
+    }
+    p->name = name;
+    p->max = r->len + 1;
+  }
+  if (fread(p->name, 1, r->len, c->f) != r->len) goto corrupt;
+  p->name[r->len] = '\0';
+  p->type = r->type;
+
+  return 0;
+
+corrupt:
+  errno = EINVAL;
+error:
+  fprintf(stderr, "%s: %s\n", c->file, errno == EINVAL ? "Corrupt snapshot." : strerror(errno));
+  return -1;
+}
+
+/// @brief open snapshot @a file with reader @a c and read its first record
+///
+/// @retval 0 on success
+/// @retval -1 on error (an error has been printed)
+static int snap_open(struct snapcur *c, const char *file)
+{
+  struct snap_hdr hdr;
+
+  memset(c, 0, sizeof(*c));
+  c->file = file;
+  c->f = fopen(file, "r");
+  if (c->f == NULL) {
+    perror(file);
+    return -1;
+  }
+  setvbuf(c->f, NULL, _IOFBF, SNAP_BUFSIZE);
+
+  if ((fread(&hdr, sizeof(hdr), 1, c->f) != 1) ||
+      (memcmp(hdr.magic, SNAP_MAGIC, sizeof(SNAP_MAGIC)) != 0) ||
+      (hdr.version != SNAP_VERSION)) {
+    fprintf(stderr, "%s: Not a snapshot.\n", file);
+    return -1;
+  }
+
+  return snap_next(c);
+}
+
+/// @brief close reader @a c
+static void snap_end(struct snapcur *c)
+{
+  if (c->f != NULL) fclose(c->f);
+  for (unsigned int i = 0; i < c->maxcomp; i++) free(c->comp[i].name);
+  free(c->comp);
+}
+
+/// @brief compare the current records of readers @a a and @a b by their paths
+static int snap_cmp(const struct snapcur *a, const struct snapcur *b)
+{
+  if (a->root != b->root) return a->root < b->root ? -1 : 1;
+
+  for (unsigned int i = 1; (i <= a->r.depth) && (i <= b->r.depth); i++) {
+    int c = dirent_order(a->comp[i].type, a->comp[i].name, b->comp[i].type, b->comp[i].name);
+    if (c != 0) return c;
+  }
+
+  return (a->r.depth > b->r.depth) - (a->r.depth < b->r.depth);
+}
+
+/// @brief print the path of the current record of reader @a c, preceded by @a tag
+static void snap_path(const struct snapcur *c, char tag)
+{
+  const char *root = c->comp[0].name;
+  size_t rlen = strlen(root);
+
+  printf("%c %s", tag, root);
+  for (unsigned int i = 1; i <= c->r.depth; i++) {
+    if ((i > 1) || (rlen == 0) || (root[rlen-1] != '/')) putchar('/');
+    fputs(c->comp[i].name, stdout);
+  }
+  if (c->r.type == DT_DIR) putchar('/');
+}
+
+int snap_diff(const char *fa, const char *fb)
+{
+  struct snapcur a, b;
+  unsigned long long added = 0, removed = 0, modified = 0;
+  long long delta = 0;
+  int res = -1;
+
+  memset(&a, 0, sizeof(a));
+  memset(&b, 0, sizeof(b));
+  if ((snap_open(&a, fa) < 0) || (snap_open(&b, fb) < 0)) goto out;
+
+  while (!a.end || !b.end) {
+    int c = a.end ? 1 : b.end ? -1 : snap_cmp(&a, &b);
+
+    if (c < 0) {
+      // only in the old snapshot
+      if (a.r.depth > 0) {
+        snap_path(&a, '-');
+        if (a.r.type != DT_DIR) printf("  (%llu bytes)", (unsigned long long)a.r.size);
+        putchar('\n');
+        removed++;
+        if (a.r.type != DT_DIR) delta -= a.r.size;
+      }
+      if (snap_next(&a) < 0) goto out;
+    } else if (c > 0) {
+      // only in the new snapshot
+      if (b.r.depth > 0) {
+        snap_path(&b, '+');
+        if (b.r.type != DT_DIR) printf("  (%llu bytes)", (unsigned long long)b.r.size);
+        putchar('\n');
+        added++;
+        if (b.r.type != DT_DIR) delta += b.r.size;
+      }
+      if (snap_next(&b) < 0) goto out;
+    } else {
+      // in both: compare the metadata
+      if ((a.r.depth > 0) && (b.r.type != DT_DIR) &&
+          ((a.r.type != b.r.type) || (a.r.err != b.r.err) || (a.r.size != b.r.size) ||
+           (a.r.mtime != b.r.mtime) || (a.r.mtime_ns != b.r.mtime_ns) || (a.r.ino != b.r.ino))) {
+        long long d = (long long)(b.r.size - a.r.size);
+        snap_path(&b, '~');
+        printf("  (%llu -> %llu bytes, %+lld)\n", (unsigned long long)a.r.size,
+               (unsigned long long)b.r.size, d);
+        modified++;
+        delta += d;
+      }
+      if ((snap_next(&a) < 0) || (snap_next(&b) < 0)) goto out;
+    }
+  }
+
+  printf("%llu added, %llu removed, %llu modified, size change %+lld bytes\n",
+         added, removed, modified, delta);
+  res = 0;
+
+out:
+  snap_end(&a);
+  snap_end(&b);
+  return res;
+}
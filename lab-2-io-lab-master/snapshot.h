@@ -0,0 +1,53 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                         I/O Lab                                    Fall 2020
+//
+/// @file
+/// @brief tree snapshots and streaming snapshot diff
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stddef.h>
+
+#include "meta.h"
+
+/// @brief create snapshot file @a path. Trees are added with snap_root() and snap_add().
+///
+/// @param path snapshot file
+/// @retval 0 on success
+/// @retval -1 on error (errno is set)
+int snap_create(const char *path);
+
+/// @brief start the tree of root directory @a dn in the snapshot
+void snap_root(const char *dn);
+
+/// @brief add an entry to the snapshot. Entries must be added in the order of a sorted
+///        depth-first traversal (see walkDir()).
+///
+/// @param depth depth of the entry below the root directory (entries of the root: 1)
+/// @param name name of the entry
+/// @param len length of @a name
+/// @param type file type (DT_*)
+/// @param m metadata of the entry
+void snap_add(unsigned int depth, const char *name, size_t len, unsigned char type,
+              const struct meta *m);
+
+/// @brief finish and close the snapshot
+///
+/// @retval 0 on success
+/// @retval -1 on error (errno is set)
+int snap_close(void);
+
+/// @brief compare snapshots @a a (old) and @a b (new) and print the added, removed, and
+///        modified entries and a summary. Memory use depends on the depth of the trees only.
+///
+/// @param a old snapshot
+/// @param b new snapshot
+/// @retval 0 on success
+/// @retval -1 if a snapshot cannot be read (an error has been printed)
+int snap_diff(const char *a, const char *b);
+
+#endif // __SNAPSHOT_H__
@@ -0,0 +1,159 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2020
+//
+/// @file
+/// @brief compiled (binary) trace format for the dynamic memory manager
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bintrace.h"
+#include "memmgr.h"
+
+/// @brief policy names as used in .dmas 'heap' commands, indexed by AllocationPolicy
+static const char *policy_names[] = {
+  [ap_FirstFit] = "firstfit",
+  [ap_NextFit]  = "nextfit",
+  [ap_BestFit]  = "bestfit",
+  [ap_Adaptive] = "adaptive",
+};
+
+#define NPOLICIES (sizeof(policy_names)/sizeof(policy_names[0]))
+
+
+void bt_init_header(TraceHeader *hdr)
+{
+  memset(hdr, 0, sizeof(*hdr));
+  memcpy(hdr->magic, BT_MAGIC, sizeof(hdr->magic));
+  hdr->version = BT_VERSION;
+  hdr->recsize = sizeof(TraceRecord);
+  hdr->dataseg = 32*1024*1024;
+  hdr->policy  = ap_FirstFit;
+  hdr->mode    = bm_Correctness;
+}
+
+
+int bt_check_header(const TraceHeader *hdr, size_t len)
+{
+  if (len < sizeof(TraceHeader)) return -1;
+  if (memcmp(hdr->magic, BT_MAGIC, sizeof(hdr->magic)) != 0) return -1;
+  if (hdr->version != BT_VERSION) return -1;
+  if (hdr->recsize != sizeof(TraceRecord)) return -1;
+  if (hdr->policy >= NPOLICIES) return -1;
+  if ((len - sizeof(TraceHeader)) / sizeof(TraceRecord) < hdr->nops) return -1;
+
+  return 0;
+}
+
+
+/// @brief check that every record of a trace has a known operation and a slot index below
+///        hdr->nslots, so replay can index the slot array without further checks
+/// @param hdr header of a mapped trace (valid, see bt_check_header())
+/// @retval 0 if all records are valid
+/// @retval -1 otherwise
+static int bt_check_records(const TraceHeader *hdr)
+{
+  const TraceRecord *r = (const TraceRecord*)(hdr + 1), *end = r + hdr->nops;
+
+  for (; r < end; r++) {
+    switch (r->op) {
+      case op_Malloc:
+      case op_Calloc:
+      case op_Realloc:
+      case op_Free:
+        if (r->slot >= hdr->nslots) return -1;
+        break;
+
+      case op_Validate:
+        break;
+
+      default:
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+int bt_open(const char *fn, Trace *t)
+{
+  struct stat sb;
+  void *map;
+
+  memset(t, 0, sizeof(*t));
+
+  int fd = open(fn, O_RDONLY);
+  if (fd < 0) return -1;
+
+  if (fstat(fd, &sb) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  if ((size_t)sb.st_size < sizeof(TraceHeader)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+
+  map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE|MAP_POPULATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return -1;
+
+  if ((bt_check_header(map, sb.st_size) != 0) || (bt_check_records(map) != 0)) {
+    munmap(map, sb.st_size);
+    errno = EINVAL;
+    return -1;
+  }
+
+  // records are consumed strictly sequentially
+  madvise(map, sb.st_size, MADV_SEQUENTIAL);
+
+  t->hdr = map;
+  t->ops = (const TraceRecord*)(t->hdr + 1);
+  t->len = sb.st_size;
+
+  return 0;
+}
+
+
+void bt_close(Trace *t)
+{
+  if (t->hdr != NULL) munmap((void*)t->hdr, t->len);
+  memset(t, 0, sizeof(*t));
+}
+
+
+int bt_write_header(FILE *f, const TraceHeader *hdr)
+{
+  if (fseek(f, 0, SEEK_SET) != 0) return -1;
+  if (fwrite(hdr, sizeof(*hdr), 1, f) != 1) return -1;
+
+  return 0;
+}
+
+
+const char* bt_policy_name(uint32_t policy)
+{
+  return policy < NPOLICIES ? policy_names[policy] : "unknown";
+}
+
+
+int bt_policy_parse(const char *name)
+{
+  for (size_t i = 0; i < NPOLICIES; i++) {
+    if (strcasecmp(name, policy_names[i]) == 0) return i;
+  }
+
+  return -1;
+}
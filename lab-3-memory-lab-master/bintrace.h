@@ -0,0 +1,127 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2020
+//
+/// @file
+/// @brief compiled (binary) trace format for the dynamic memory manager
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+#ifndef __BINTRACE_H__
+#define __BINTRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+//
+// Binary trace format
+// ===================
+// A binary trace is the compiled form of the action section of a .dmas script. It consists of a
+// fixed-size header followed by an array of fixed-size operation records:
+//
+//   +-------------+-----------+-----------+-----     -----+-----------+
+//   | TraceHeader | record 0  | record 1  |      ...      | record n-1|
+//   +-------------+-----------+-----------+-----     -----+-----------+
+//    <- 64 bytes -> <- 32 -->
+//
+// All fields are stored in host byte order. The file is meant to be mmap'ed and iterated
+// directly; no parsing is required at replay time.
+//
+
+#define BT_MAGIC           "DMASBIN"                   ///< file magic (8 bytes incl. '\0')
+#define BT_VERSION         1                           ///< current format version
+
+#define BT_F_TIMESTAMP     0x1                         ///< records carry a timestamp (ns)
+#define BT_F_SEQUENCE      0x2                         ///< timestamps are logical sequence numbers
+
+/// @brief execution modes (.dmas 'mode' command)
+typedef enum {
+  bm_Correctness = 0,                                  ///< correctness mode
+  bm_Performance = 1,                                  ///< performance mode
+} TraceMode;
+
+/// @brief trace operations. The values match the action letters of .dmas scripts
+typedef enum {
+  op_Malloc   = 'm',                                   ///< m <slot> <size>
+  op_Calloc   = 'c',                                   ///< c <slot> <nelem> <size>
+  op_Realloc  = 'r',                                   ///< r <slot> <size>
+  op_Free     = 'f',                                   ///< f <slot>
+  op_Validate = 'v',                                   ///< v
+} TraceOp;
+
+/// @brief trace file header
+typedef struct {
+  char     magic[8];                                   ///< BT_MAGIC
+  uint32_t version;                                    ///< BT_VERSION
+  uint32_t recsize;                                    ///< size of one record in bytes
+  uint64_t dataseg;                                    ///< size of data segment in bytes
+  uint32_t policy;                                     ///< allocation policy (AllocationPolicy)
+  uint32_t mode;                                       ///< execution mode (TraceMode)
+  uint32_t flags;                                      ///< BT_F_* flags
+  uint32_t rsvd0;                                      ///< reserved, must be 0
+  uint64_t nslots;                                     ///< number of slots (max. slot index + 1)
+  uint64_t nops;                                       ///< number of records following the header
+  uint64_t rsvd1;                                      ///< reserved, must be 0
+} TraceHeader;
+
+/// @brief operation record
+typedef struct {
+  uint8_t  op;                                         ///< operation (TraceOp)
+  uint8_t  rsvd[3];                                    ///< reserved, must be 0
+  uint32_t slot;                                       ///< slot index
+  uint64_t size;                                       ///< size in bytes (element size for calloc)
+  uint64_t nelem;                                      ///< number of elements (calloc only)
+  uint64_t ts;                                         ///< timestamp (valid if BT_F_TIMESTAMP)
+} TraceRecord;
+
+/// @brief a binary trace mapped into memory
+typedef struct {
+  const TraceHeader *hdr;                              ///< trace header
+  const TraceRecord *ops;                              ///< operation records
+  size_t            len;                               ///< length of mapping in bytes
+} Trace;
+
+/// @brief initialize a trace header with default settings (32 MB data segment, first fit,
+///        correctness mode, no operations)
+/// @param hdr header to initialize
+void bt_init_header(TraceHeader *hdr);
+
+/// @brief check a trace header for consistency
+/// @param hdr header to check
+/// @param len size of the trace file in bytes
+/// @retval 0 if the header is valid
+/// @retval -1 otherwise
+int bt_check_header(const TraceHeader *hdr, size_t len);
+
+/// @brief map a binary trace into memory (read-only)
+/// @param fn file name
+/// @param[out] t mapped trace
+/// @retval 0 on success
+/// @retval -1 on error. errno is set (EINVAL for malformed traces, including records with an
+///         unknown operation or a slot index >= nslots)
+int bt_open(const char *fn, Trace *t);
+
+/// @brief unmap a binary trace
+/// @param t trace mapped by bt_open()
+void bt_close(Trace *t);
+
+/// @brief write a trace header to the start of @a f. The file position is left after the header.
+/// @param f output stream
+/// @param hdr header to write
+/// @retval 0 on success
+/// @retval -1 on error
+int bt_write_header(FILE *f, const TraceHeader *hdr);
+
+/// @brief return the name of an allocation policy as used in .dmas 'heap' commands
+/// @param policy allocation policy
+/// @retval policy name or "unknown"
+const char* bt_policy_name(uint32_t policy);
+
+/// @brief parse the name of an allocation policy as used in .dmas 'heap' commands
+/// @param name policy name
+/// @retval AllocationPolicy on success
+/// @retval -1 if the name is unknown
+int bt_policy_parse(const char *name);
+
+#endif // __BINTRACE_H__
@@ -0,0 +1,236 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2020
+//
+/// @file
+/// @brief convert .dmas scripts into binary traces and back
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <libgen.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "bintrace.h"
+#include "memmgr.h"
+
+
+/// @brief print error message and terminate process
+/// @param fmt printf format string
+/// @param ... variadic parameters for @a fmt
+static void panic(const char *fmt, ...)
+{
+  va_list va;
+  va_start(va, fmt);
+  fprintf(stderr, "ERROR: ");
+  vfprintf(stderr, fmt, va);
+  fprintf(stderr, "\n");
+  va_end(va);
+
+  exit(EXIT_FAILURE);
+}
+
+
+/// @brief compile the .dmas script @a in into the binary trace @a out
+/// @param in input stream (.dmas script)
+/// @param fin name of input (for error messages)
+/// @param out output stream (binary trace)
+static void compile(FILE *in, const char *fin, FILE *out)
+{
+  TraceHeader hdr;
+  TraceRecord rec;
+  char *line = NULL, *cmd, *arg;
+  size_t lsize = 0;
+  unsigned long lineno = 0;
+  int started = 0, stopped = 0;
+
+  bt_init_header(&hdr);
+  if (bt_write_header(out, &hdr) != 0) panic("cannot write header: %s", strerror(errno));
+
+  while (getline(&line, &lsize, in) != -1) {
+    lineno++;
+
+    // strip comments and surrounding whitespace
+    char *hash = strchr(line, '#');
+    if (hash != NULL) *hash = '\0';
+
+    cmd = strtok(line, " \t\r\n");
+    if (cmd == NULL) continue;
+
+    if (started && !stopped && (strlen(cmd) == 1)) {
+      //
+      // actions
+      //
+      unsigned long slot = 0, nelem = 0, size = 0;
+      int nargs = 0;
+      char *end;
+
+      memset(&rec, 0, sizeof(rec));
+      rec.op = cmd[0];
+
+      while ((nargs < 3) && ((arg = strtok(NULL, " \t\r\n")) != NULL)) {
+        unsigned long v = strtoul(arg, &end, 0);
+        if (*end != '\0') panic("%s:%lu: invalid number '%s'.", fin, lineno, arg);
+
+        if      (nargs == 0) slot = v;
+        else if (nargs == 1) size = v;
+        else                 { nelem = size; size = v; }
+        nargs++;
+      }
+
+      switch (rec.op) {
+        case op_Malloc:
+        case op_Realloc:   if (nargs != 2) panic("%s:%lu: invalid action.", fin, lineno); break;
+        case op_Calloc:    if (nargs != 3) panic("%s:%lu: invalid action.", fin, lineno); break;
+        case op_Free:      if (nargs != 1) panic("%s:%lu: invalid action.", fin, lineno); break;
+        case op_Validate:  if (nargs != 0) panic("%s:%lu: invalid action.", fin, lineno); break;
+        default:           panic("%s:%lu: invalid action '%s'.", fin, lineno, cmd);
+      }
+
+      if (slot > UINT32_MAX) panic("%s:%lu: slot index out of range.", fin, lineno);
+
+      rec.slot = slot;
+      rec.size = size;
+      rec.nelem = nelem;
+      if ((rec.op != op_Validate) && (slot >= hdr.nslots)) hdr.nslots = slot+1;
+
+      if (fwrite(&rec, sizeof(rec), 1, out) != 1) {
+        panic("cannot write record: %s", strerror(errno));
+      }
+      hdr.nops++;
+
+    } else {
+      //
+      // commands
+      //
+      arg = strtok(NULL, " \t\r\n");
+
+      if (strcmp(cmd, "dataseg") == 0) {
+        if (arg == NULL) panic("%s:%lu: missing size in '%s' command.", fin, lineno, cmd);
+        hdr.dataseg = strtoul(arg, NULL, 0);
+      } else if (strcmp(cmd, "heap") == 0) {
+        int ap = arg ? bt_policy_parse(arg) : -1;
+        if (ap < 0) panic("%s:%lu: invalid allocation policy in '%s' command.", fin, lineno, cmd);
+        hdr.policy = ap;
+      } else if (strcmp(cmd, "mode") == 0) {
+        if      (arg && (strcmp(arg, "correctness") == 0)) hdr.mode = bm_Correctness;
+        else if (arg && (strcmp(arg, "performance") == 0)) hdr.mode = bm_Performance;
+        else panic("%s:%lu: invalid execution mode in '%s' command.", fin, lineno, cmd);
+      } else if (strcmp(cmd, "start") == 0) {
+        if (started) panic("%s:%lu: duplicated '%s' command.", fin, lineno, cmd);
+        started = 1;
+      } else if (strcmp(cmd, "stop") == 0) {
+        stopped = 1;
+      } else if ((strcmp(cmd, "log") == 0) || (strcmp(cmd, "debug") == 0) ||
+                 (strcmp(cmd, "stat") == 0) || (strcmp(cmd, "quit") == 0)) {
+        // interactive commands are not part of the compiled trace
+      } else {
+        panic("%s:%lu: invalid command '%s'.", fin, lineno, cmd);
+      }
+    }
+  }
+
+  free(line);
+
+  if (bt_write_header(out, &hdr) != 0) panic("cannot write header: %s", strerror(errno));
+
+  fprintf(stderr, "%s: %lu operations, %lu slots, %s, %s mode.\n",
+          fin, (unsigned long)hdr.nops, (unsigned long)hdr.nslots, bt_policy_name(hdr.policy),
+          hdr.mode == bm_Performance ? "performance" : "correctness");
+}
+
+
+/// @brief decompile the binary trace @a fin into a .dmas script
+/// @param fin name of binary trace
+/// @param out output stream (.dmas script)
+static void decompile(const char *fin, FILE *out)
+{
+  Trace t;
+
+  if (bt_open(fin, &t) != 0) panic("cannot open trace '%s': %s", fin, strerror(errno));
+
+  fprintf(out, "#\n"
+               "# decompiled from %s (%lu operations)\n"
+               "#\n"
+               "\n"
+               "dataseg 0x%lx\n"
+               "heap %s\n"
+               "\n"
+               "mode %s\n"
+               "\n"
+               "start\n",
+               fin, (unsigned long)t.hdr->nops, (unsigned long)t.hdr->dataseg,
+               bt_policy_name(t.hdr->policy),
+               t.hdr->mode == bm_Performance ? "performance" : "correctness");
+
+  for (uint64_t i = 0; i < t.hdr->nops; i++) {
+    const TraceRecord *r = &t.ops[i];
+
+    switch (r->op) {
+      case op_Malloc:
+      case op_Realloc:   fprintf(out, "%c %u %lu\n", r->op, r->slot, (unsigned long)r->size); break;
+      case op_Calloc:    fprintf(out, "c %u %lu %lu\n", r->slot, (unsigned long)r->nelem,
+                                 (unsigned long)r->size); break;
+      case op_Free:      fprintf(out, "f %u\n", r->slot); break;
+      case op_Validate:  fprintf(out, "v\n"); break;
+      default:           panic("%s: invalid operation 0x%02x in record %lu.", fin, r->op, i);
+    }
+  }
+
+  fprintf(out, "stop\nstat\n");
+
+  bt_close(&t);
+}
+
+
+/// @brief print program syntax and exit
+/// @param argv0 program name
+static void syntax(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s <script.dmas> <trace.bin>\n"
+                  "       %s -d <trace.bin> [script.dmas]\n"
+                  "Compile a .dmas script into a binary trace for mm_replay, or decompile a binary\n"
+                  "trace (-d) into a .dmas script (default: stdout).\n",
+                  basename((char*)argv0), basename((char*)argv0));
+
+  exit(EXIT_FAILURE);
+}
+
+
+/// @brief program entry point
+int main(int argc, char *argv[])
+{
+  if ((argc >= 3) && (strcmp(argv[1], "-d") == 0)) {
+    FILE *out = stdout;
+
+    if (argc > 4) syntax(argv[0]);
+    if ((argc == 4) && ((out = fopen(argv[3], "w")) == NULL)) {
+      panic("cannot open '%s': %s", argv[3], strerror(errno));
+    }
+
+    decompile(argv[2], out);
+    if (out != stdout) fclose(out);
+
+  } else if ((argc == 3) && (argv[1][0] != '-')) {
+    FILE *in = fopen(argv[1], "r");
+    if (in == NULL) panic("cannot open '%s': %s", argv[1], strerror(errno));
+
+    FILE *out = fopen(argv[2], "w");
+    if (out == NULL) panic("cannot open '%s': %s", argv[2], strerror(errno));
+
+    compile(in, argv[1], out);
+
+    fclose(in);
+    if (fclose(out) != 0) panic("cannot write '%s': %s", argv[2], strerror(errno));
+
+  } else {
+    syntax(argv[0]);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2020
+//
+/// @file
+/// @brief decode event traces written by the memory manager (see evtrace.h)
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "evtrace.h"
+
+
+/// @brief number of event types (EventType values are smaller than this)
+#define NTYPES             (ev_Switch + 1)
+
+
+/// @brief print one event
+/// @param e event
+/// @param t0 cycle counter of the first event
+static void print_event(const Event *e, uint64_t t0)
+{
+  printf("%14lu  %-11s ", (unsigned long)(e->cycles - t0), evt_name(e->op));
+
+  switch (e->op) {
+    case ev_Init:
+      printf("heap_start: 0x%lx, size: 0x%lx, policy: %u\n",
+             (unsigned long)e->ptr, (unsigned long)e->size, e->aux);
+      break;
+
+    case ev_Search:
+      printf("0x%lx, size: 0x%lx, examined: %u\n",
+             (unsigned long)e->ptr, (unsigned long)e->size, e->aux);
+      break;
+
+    case ev_Examine:
+      printf("  0x%lx, size: 0x%lx, status: %s\n",
+             (unsigned long)e->ptr, (unsigned long)(e->size & ~7UL),
+             (e->size & 1) ? "allocated" : "free");
+      break;
+
+    case ev_Coalesce:
+      printf("0x%lx, size: 0x%lx, with: %s\n",
+             (unsigned long)e->ptr, (unsigned long)e->size,
+             e->aux == 3 ? "both" : e->aux == 2 ? "previous" : "next");
+      break;
+
+    case ev_Realloc:
+      printf("0x%lx, size: 0x%lx%s\n",
+             (unsigned long)e->ptr, (unsigned long)e->size, e->aux ? " (in place)" : "");
+      break;
+
+    case ev_Expand:
+      printf("heap_end: 0x%lx, increment: 0x%lx%s\n",
+             (unsigned long)e->ptr, (unsigned long)e->size, e->aux ? " FAILED" : "");
+      break;
+
+    case ev_Switch:
+      printf("to policy %lu (switch #%u)\n", (unsigned long)e->size, e->aux);
+      break;
+
+    default:
+      printf("0x%lx, size: 0x%lx\n", (unsigned long)e->ptr, (unsigned long)e->size);
+  }
+}
+
+
+/// @brief print a summary of all events: number of events per type, and search lengths
+/// @param ev events
+/// @param n number of events
+static void print_summary(const Event *ev, uint64_t n)
+{
+  unsigned long count[NTYPES] = { 0 };
+  unsigned long examined = 0, max_examined = 0, failed = 0;
+
+  for (uint64_t i = 0; i < n; i++) {
+    const Event *e = &ev[i];
+
+    if (e->op < NTYPES) count[e->op]++;
+
+    if (e->op == ev_Search) {
+      examined += e->aux;
+      if (e->aux > max_examined) max_examined = e->aux;
+      if (e->ptr == 0) failed++;
+    }
+  }
+
+  printf("Events:\n");
+  for (int t = 1; t < NTYPES; t++) {
+    if (count[t] > 0) printf("  %-14s %10lu\n", evt_name(t), count[t]);
+  }
+  if (n > 0) {
+    printf("  cycles:        %10lu\n", (unsigned long)(ev[n-1].cycles - ev[0].cycles));
+  }
+  if (count[ev_Search] > 0) {
+    printf("Searches:\n"
+           "  examined:       %10lu blocks (avg: %.2f, max: %lu)\n"
+           "  unsuccessful:   %10lu\n",
+           examined, (double)examined / count[ev_Search], max_examined, failed);
+  }
+}
+
+
+/// @brief print program syntax and exit
+/// @param argv0 program name
+static void syntax(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-s] <events.bin>\n"
+                  "Decode an event trace of the memory manager (built with EVTRACE=1 or 2).\n"
+                  "\n"
+                  "Options:\n"
+                  " -s           print a summary instead of the individual events\n",
+                  basename((char*)argv0));
+
+  exit(EXIT_FAILURE);
+}
+
+
+/// @brief program entry point
+int main(int argc, char *argv[])
+{
+  const char *fn = NULL;
+  int summary = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if      (strcmp(argv[i], "-s") == 0) summary = 1;
+    else if (fn == NULL) fn = argv[i];
+    else syntax(argv[0]);
+  }
+
+  if (fn == NULL) syntax(argv[0]);
+
+  //
+  // map event file
+  //
+  struct stat sb;
+  int fd = open(fn, O_RDONLY);
+  if ((fd < 0) || (fstat(fd, &sb) < 0)) {
+    fprintf(stderr, "ERROR: cannot open '%s': %s.\n", fn, strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  const EventHeader *hdr = NULL;
+  if ((size_t)sb.st_size >= sizeof(EventHeader)) {
+    hdr = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (hdr == MAP_FAILED) hdr = NULL;
+  }
+  close(fd);
+
+  if ((hdr == NULL) || (memcmp(hdr->magic, EVT_MAGIC, sizeof(hdr->magic)) != 0) ||
+      (hdr->version != EVT_VERSION) || (hdr->recsize != sizeof(Event)) ||
+      ((sb.st_size - sizeof(EventHeader)) / sizeof(Event) < hdr->nevents)) {
+    fprintf(stderr, "ERROR: '%s' is not a valid event trace.\n", fn);
+    return EXIT_FAILURE;
+  }
+
+  const Event *ev = (const Event*)(hdr + 1);
+  uint64_t n = hdr->nevents;
+
+  if (hdr->dropped > 0) {
+    printf("%lu older events were overwritten in the ring buffer.\n",
+           (unsigned long)hdr->dropped);
+  }
+
+  //
+  // decode
+  //
+  if (summary) {
+    print_summary(ev, n);
+  } else {
+    for (uint64_t i = 0; i < n; i++) print_event(&ev[i], ev[0].cycles);
+  }
+
+  munmap((void*)hdr, sb.st_size);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2020
+//
+/// @file
+/// @brief low-overhead binary event tracing for the dynamic memory manager
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "evtrace.h"
+
+/// @brief event names, indexed by EventType
+static const char *event_names[] = {
+  [ev_Init]       = "init",
+  [ev_Malloc]     = "malloc",
+  [ev_Calloc]     = "calloc",
+  [ev_Realloc]    = "realloc",
+  [ev_Free]       = "free",
+  [ev_Search]     = "search",
+  [ev_Examine]    = "examine",
+  [ev_Split]      = "split",
+  [ev_Coalesce]   = "coalesce",
+  [ev_Expand]     = "expand",
+  [ev_DoubleFree] = "double-free",
+  [ev_Switch]     = "switch",
+};
+
+#define NEVENTS (sizeof(event_names)/sizeof(event_names[0]))
+
+
+const char* evt_name(uint32_t op)
+{
+  return (op < NEVENTS) && (event_names[op] != NULL) ? event_names[op] : "unknown";
+}
+
+
+#if defined(MM_EVTRACE) && (MM_EVTRACE > 0)
+
+Event    evt_buffer[EVT_CAPACITY];
+uint64_t evt_head = 0;
+
+int evt_dump(const char *fn)
+{
+  EventHeader hdr;
+  uint64_t n = evt_head < EVT_CAPACITY ? evt_head : EVT_CAPACITY;
+  uint64_t first = (evt_head - n) & (EVT_CAPACITY-1);
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, EVT_MAGIC, sizeof(hdr.magic));
+  hdr.version = EVT_VERSION;
+  hdr.recsize = sizeof(Event);
+  hdr.nevents = n;
+  hdr.dropped = evt_head - n;
+
+  FILE *f = fopen(fn, "w");
+  if (f == NULL) return -1;
+
+  // the oldest events are at 'first'; write up to the end of the buffer, then the wrapped part
+  uint64_t tail = EVT_CAPACITY - first < n ? EVT_CAPACITY - first : n;
+  int res = (fwrite(&hdr, sizeof(hdr), 1, f) == 1) &&
+            (fwrite(&evt_buffer[first], sizeof(Event), tail, f) == tail) &&
+            (fwrite(&evt_buffer[0], sizeof(Event), n - tail, f) == n - tail);
+
+  if ((fclose(f) != 0) || !res) return -1;
+
+  return 0;
+}
+
+#else
+
+int evt_dump(const char *fn)
+{
+  (void)fn;
+  errno = ENOTSUP;
+  return -1;
+}
+
+#endif
@@ -0,0 +1,148 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2020
+//
+/// @file
+/// @brief low-overhead binary event tracing for the dynamic memory manager
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+#ifndef __EVTRACE_H__
+#define __EVTRACE_H__
+
+#include <stdint.h>
+
+//
+// Event tracing
+// =============
+// The memory manager records events as fixed-size binary records into a ring buffer instead of
+// formatting log messages with printf. Recording an event costs a handful of stores and a cycle
+// counter read; the records are decoded offline by evdecode.
+//
+// Tracing is selected at compile time with MM_EVTRACE (make EVTRACE=<level>):
+//   0 (or undefined)  no tracing; EVT() and EVT2() compile to nothing
+//   1                 operations (malloc, calloc, realloc, free), searches, splits, coalescing,
+//                     heap expansions
+//   2                 in addition, every block examined by a free block search
+//
+// The ring buffer holds the last EVT_CAPACITY events. evt_dump() writes them to a file:
+//
+//   +-------------+-----------+-----------+-----     -----+-----------+
+//   | EventHeader | event 0   | event 1   |      ...      | event n-1 |
+//   +-------------+-----------+-----------+-----     -----+-----------+
+//    <- 32 bytes -> <- 32 -->
+//
+// Events are stored oldest first, in host byte order.
+//
+
+#define EVT_MAGIC          "MMEVTRC"                   ///< file magic (8 bytes incl. '\0')
+#define EVT_VERSION        1                           ///< current format version
+#define EVT_CAPACITY       (1 << 20)                   ///< ring buffer capacity. Power of 2
+
+/// @brief event types
+typedef enum {
+  ev_Init = 1,                                         ///< mm_init: ptr=heap_start, size=heap size,
+                                                       ///<   aux=policy
+  ev_Malloc,                                           ///< mm_malloc: ptr=result, size=request
+  ev_Calloc,                                           ///< mm_calloc: ptr=result, size=nelem*size
+  ev_Realloc,                                          ///< mm_realloc: ptr=result, size=request,
+                                                       ///<   aux=1 if resized in place
+  ev_Free,                                             ///< block freed (mm_free, mm_realloc):
+                                                       ///<   ptr=payload, size=block size
+  ev_Search,                                           ///< *_get_free_block: ptr=block or NULL,
+                                                       ///<   size=block size, aux=#examined
+  ev_Examine,                                          ///< block examined by search (level 2):
+                                                       ///<   ptr=block, size=tag (size|status)
+  ev_Split,                                            ///< block split: ptr=remainder, size=its size
+  ev_Coalesce,                                         ///< coalesce: ptr=block, size=new size,
+                                                       ///<   aux=1: next, 2: previous, 3: both
+  ev_Expand,                                           ///< expand_heap: ptr=old heap_end,
+                                                       ///<   size=increment, aux=1 on failure
+  ev_DoubleFree,                                       ///< free of a free block: ptr=payload
+  ev_Switch,                                           ///< adaptive policy switch: size=new policy,
+                                                       ///<   aux=number of switches
+} EventType;
+
+/// @brief event record
+typedef struct {
+  uint8_t  op;                                         ///< event type (EventType)
+  uint8_t  rsvd[3];                                    ///< reserved, 0
+  uint32_t aux;                                        ///< event specific
+  uint64_t ptr;                                        ///< address
+  uint64_t size;                                       ///< size in bytes
+  uint64_t cycles;                                     ///< cycle counter
+} Event;
+
+/// @brief event file header
+typedef struct {
+  char     magic[8];                                   ///< EVT_MAGIC
+  uint32_t version;                                    ///< EVT_VERSION
+  uint32_t recsize;                                    ///< size of one event in bytes
+  uint64_t nevents;                                    ///< number of events following the header
+  uint64_t dropped;                                    ///< number of overwritten (lost) events
+} EventHeader;
+
+
+#if defined(MM_EVTRACE) && (MM_EVTRACE > 0)
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define EVT_CYCLES()       __rdtsc()                   ///< read cycle counter
+#else
+#include <time.h>
+/// @brief read monotonic clock in ns as a substitute for a cycle counter
+static inline uint64_t evt_cycles(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#define EVT_CYCLES()       evt_cycles()                ///< read cycle counter
+#endif
+
+extern Event    evt_buffer[EVT_CAPACITY];              ///< ring buffer
+extern uint64_t evt_head;                              ///< total number of events recorded
+
+/// @brief record an event. Do not call directly; use EVT() or EVT2() instead
+static inline void evt_record(EventType op, const void *ptr, uint64_t size, uint32_t aux)
+{
+  Event *e = &evt_buffer[evt_head++ & (EVT_CAPACITY-1)];
+
+  e->op = op;
+  e->aux = aux;
+  e->ptr = (uintptr_t)ptr;
+  e->size = size;
+  e->cycles = EVT_CYCLES();
+}
+
+/// @brief record an event (tracing level >= 1)
+#define EVT(op, ptr, size, aux) evt_record(op, ptr, size, aux)
+
+#if MM_EVTRACE > 1
+/// @brief record a verbose event (tracing level >= 2)
+#define EVT2(op, ptr, size, aux) evt_record(op, ptr, size, aux)
+#else
+#define EVT2(op, ptr, size, aux) ((void)(ptr), (void)(size), (void)(aux))
+#endif
+
+#else
+
+// arguments are referenced to avoid warnings about unused variables; they are side-effect free
+#define EVT(op, ptr, size, aux)  ((void)(ptr), (void)(size), (void)(aux))
+#define EVT2(op, ptr, size, aux) ((void)(ptr), (void)(size), (void)(aux))
+
+#endif
+
+
+/// @brief write the events in the ring buffer to file @a fn (oldest first)
+/// @param fn file name
+/// @retval 0 on success
+/// @retval -1 on error. errno is set (ENOTSUP if the memory manager was built without tracing)
+int evt_dump(const char *fn);
+
+/// @brief return the name of an event type
+/// @param op event type
+/// @retval event name or "unknown"
+const char* evt_name(uint32_t op);
+
+#endif // __EVTRACE_H__
@@ -0,0 +1,352 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2020
+//
+/// @file
+/// @brief drop-in replacement of the C library's allocator built on our memory manager
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+// Drop-in allocator
+// =================
+//
+// This library exports the allocation API of the C library (malloc, free, calloc, realloc,
+// posix_memalign, aligned_alloc, memalign, valloc, pvalloc, malloc_usable_size) and implements it
+// on top of memmgr and the simulated data segment. Any dynamically linked program can be run on
+// our allocator:
+//
+//   $ LD_PRELOAD=./libmemmgr.so <program> <args>
+//
+// The data segment and the heap are initialized lazily by the first allocation. The following
+// environment variables are evaluated at that point:
+//
+//   MEMMGR_HEAP      maximum heap size in bytes (default: 1 GB)
+//   MEMMGR_POLICY    allocation policy: firstfit, nextfit, bestfit, adaptive (default: firstfit)
+//   MEMMGR_ADAPTIVE  budgets of the adaptive policy: <window>,<max_examined>,<min_util>
+//
+// The memory manager is not thread-safe; all calls are serialized with one global lock.
+//
+// Alignment:
+// ----------
+// memmgr returns payloads that are aligned to 8 bytes (the header word follows a 32-byte aligned
+// block boundary). The C library guarantees 16-byte alignment, and memalign() and friends need
+// arbitrary power-of-two alignments. We therefore over-allocate, return an aligned pointer inside
+// the payload, and store a marker word holding the offset to the start of the payload right in
+// front of the returned pointer:
+//
+//        payload                     ptr (aligned)
+//          |                          |
+//          v                          v
+//   +---+--------------------+------+------------------------------+---+
+//   | H |  (unused)          |marker|  user data                   | F |
+//   +---+--------------------+------+------------------------------+---+
+//
+// The marker's low three bits are MARKER (2), a value never used by memmgr's boundary tags, and
+// the remaining bits hold the offset from the payload to ptr.
+//
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "dataseg.h"
+#include "memmgr.h"
+
+
+/// @name Macro definitions
+/// @{
+
+#define MIN(a, b)         ((a) < (b) ? (a) : (b))      ///< MIN function
+#define DEFAULT_HEAP      (1UL << 30)                  ///< default heap size
+#define MIN_ALIGN         16                           ///< alignment of malloc'ed blocks
+#define WORD_SIZE         sizeof(uintptr_t)            ///< size of marker word
+#define MARKER            0x2                          ///< tag of marker word
+#define MARKER_MASK       0x7                          ///< mask to extract marker tag
+
+#define LOCK()            pthread_mutex_lock(&mm_mtx)
+#define UNLOCK()          pthread_mutex_unlock(&mm_mtx)
+/// @}
+
+
+/// @name global variables
+/// @{
+
+static pthread_mutex_t mm_mtx = PTHREAD_MUTEX_INITIALIZER;    ///< serializes memmgr calls
+static int initialized = 0;                                   ///< heap initialized
+static void *heap_lo = NULL;                                  ///< start of data segment heap
+static void *heap_hi = NULL;                                  ///< end of data segment heap
+/// @}
+
+
+/// @brief initialize data segment and heap. Must be called with mm_mtx held
+static void init(void)
+{
+  const char *heap = getenv("MEMMGR_HEAP");
+  const char *policy = getenv("MEMMGR_POLICY");
+  const char *budgets = getenv("MEMMGR_ADAPTIVE");
+  size_t size = DEFAULT_HEAP;
+  AllocationPolicy ap = ap_FirstFit;
+
+  if (heap != NULL) size = strtoul(heap, NULL, 0);
+  if (policy != NULL) {
+    if      (strcasecmp(policy, "nextfit") == 0) ap = ap_NextFit;
+    else if (strcasecmp(policy, "bestfit") == 0) ap = ap_BestFit;
+    else if (strcasecmp(policy, "adaptive") == 0) ap = ap_Adaptive;
+  }
+  if (budgets != NULL) {
+    // not parsed with sscanf, which may allocate memory while we hold mm_mtx
+    char *end;
+    unsigned long window = strtoul(budgets, &end, 0);
+    double max_examined = (*end == ',') ? strtod(end+1, &end) : 0;
+    double min_util = (*end == ',') ? strtod(end+1, &end) : 0;
+    if (*end == '\0') mm_setadaptive(window, max_examined, min_util);
+  }
+
+  ds_allocate(size);
+  mm_init(ap);
+  ds_heap_stat(&heap_lo, NULL, &heap_hi);
+
+  initialized = 1;
+}
+
+/// @brief check whether @a ptr was allocated by us
+#define IS_OURS(ptr) (((void*)(ptr) >= heap_lo) && ((void*)(ptr) < heap_hi))
+
+/// @brief usable size of a foreign block @a ptr, i.e., one allocated by the next allocator in
+///        the search order before we were loaded. Must be called without mm_mtx held: resolving
+///        the next allocator's malloc_usable_size() may allocate. Aborts if it cannot be resolved.
+static size_t foreign_size(void *ptr)
+{
+  static size_t (*next_usable_size)(void*) = NULL;
+
+  size_t (*fn)(void*) = __atomic_load_n(&next_usable_size, __ATOMIC_ACQUIRE);
+  if (fn == NULL) {
+    fn = (size_t (*)(void*))dlsym(RTLD_NEXT, "malloc_usable_size");
+    if (fn == NULL) {
+      static const char msg[] = "libmemmgr: realloc of a foreign block of unknown size\n";
+      if (write(STDERR_FILENO, msg, sizeof(msg)-1) < 0) {}
+      abort();
+    }
+    __atomic_store_n(&next_usable_size, fn, __ATOMIC_RELEASE);
+  }
+
+  return fn(ptr);
+}
+
+/// @brief get the memmgr payload of the user pointer @a ptr
+/// @param ptr pointer returned to the user
+/// @retval void* payload pointer as returned by mm_malloc()
+static void* payload(void *ptr)
+{
+  uintptr_t marker = *((uintptr_t*)ptr - 1);
+
+  if ((marker & MARKER_MASK) != MARKER) return ptr;
+
+  return ptr - (marker >> 3);
+}
+
+/// @brief allocate @a size bytes aligned to @a align. Must be called with mm_mtx held
+/// @param align alignment (power of two, >= MIN_ALIGN)
+/// @param size size in bytes
+/// @retval void* aligned pointer
+/// @retval NULL if the allocation failed
+static void* alloc_aligned(size_t align, size_t size)
+{
+  if (!initialized) init();
+
+  // the payload is aligned to WORD_SIZE, so the aligned pointer lies at most align bytes into it
+  if (size > SIZE_MAX - align) return NULL;
+
+  void *p = mm_malloc(size + align);
+  if (p == NULL) return NULL;
+
+  void *ptr = (void*)(((uintptr_t)p + WORD_SIZE + align-1) & ~(uintptr_t)(align-1));
+  *((uintptr_t*)ptr - 1) = ((uintptr_t)(ptr - p) << 3) | MARKER;
+
+  return ptr;
+}
+
+/// @brief usable size of user pointer @a ptr. Must be called with mm_mtx held
+static size_t usable_size(void *ptr)
+{
+  void *p = payload(ptr);
+
+  return mm_usable_size(p) - (ptr - p);
+}
+
+
+//--------------------------------------------------------------------------------------------------
+/// @name C library allocation API
+/// @{
+
+void* malloc(size_t size)
+{
+  LOCK();
+  void *ptr = alloc_aligned(MIN_ALIGN, size);
+  UNLOCK();
+
+  if (ptr == NULL) errno = ENOMEM;
+
+  return ptr;
+}
+
+void free(void *ptr)
+{
+  if (ptr == NULL) return;
+
+  LOCK();
+  // blocks allocated before we were loaded (e.g., by the dynamic loader) are never released
+  if (initialized && IS_OURS(ptr)) mm_free(payload(ptr));
+  UNLOCK();
+}
+
+void* calloc(size_t nelem, size_t size)
+{
+  if ((size != 0) && (nelem > SIZE_MAX / size)) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  // not implemented as malloc()+memset(): the compiler would fold that pattern into calloc()
+  LOCK();
+  void *ptr = alloc_aligned(MIN_ALIGN, nelem * size);
+  UNLOCK();
+
+  if (ptr != NULL) memset(ptr, 0, nelem * size);
+  else errno = ENOMEM;
+
+  return ptr;
+}
+
+void* realloc(void *ptr, size_t size)
+{
+  if (ptr == NULL) return malloc(size);
+
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+
+  // the heap bounds are set once; a block handed to us was allocated after that or is foreign
+  if (!IS_OURS(ptr)) {
+    // foreign block: copy it to a new block; like in free(), the old block is not released
+    size_t osize = foreign_size(ptr);
+    void *nptr = malloc(size);
+    if (nptr != NULL) memcpy(nptr, ptr, MIN(size, osize));
+    return nptr;
+  }
+
+  LOCK();
+
+  void *nptr = NULL;
+
+  if (usable_size(ptr) >= size) {
+    nptr = ptr;
+  } else {
+    nptr = alloc_aligned(MIN_ALIGN, size);
+    if (nptr != NULL) {
+      memcpy(nptr, ptr, usable_size(ptr));
+      mm_free(payload(ptr));
+    }
+  }
+
+  UNLOCK();
+
+  if (nptr == NULL) errno = ENOMEM;
+
+  return nptr;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+  if ((alignment == 0) || (alignment & (alignment-1)) || (alignment % sizeof(void*) != 0)) {
+    return EINVAL;
+  }
+
+  LOCK();
+  void *ptr = alloc_aligned(alignment < MIN_ALIGN ? MIN_ALIGN : alignment, size);
+  UNLOCK();
+
+  if (ptr == NULL) return ENOMEM;
+
+  *memptr = ptr;
+  return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+  if ((alignment == 0) || (alignment & (alignment-1))) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  LOCK();
+  void *ptr = alloc_aligned(alignment < MIN_ALIGN ? MIN_ALIGN : alignment, size);
+  UNLOCK();
+
+  if (ptr == NULL) errno = ENOMEM;
+
+  return ptr;
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+  return aligned_alloc(alignment, size);
+}
+
+void* valloc(size_t size)
+{
+  return aligned_alloc(getpagesize(), size);
+}
+
+void* pvalloc(size_t size)
+{
+  size_t pagesize = getpagesize();
+
+  return aligned_alloc(pagesize, (size + pagesize-1) & ~(pagesize-1));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+  if (ptr == NULL) return 0;
+
+  LOCK();
+  size_t size = IS_OURS(ptr) ? usable_size(ptr) : 0;
+  UNLOCK();
+
+  return size;
+}
+
+/// @}
+
+
+//--------------------------------------------------------------------------------------------------
+/// @name fork handling
+/// @{
+
+/// @brief fork prepare handler: make sure the heap is consistent while forking
+static void atfork_prepare(void)
+{
+  LOCK();
+}
+
+/// @brief fork handler (parent and child)
+static void atfork_release(void)
+{
+  UNLOCK();
+}
+
+/// @brief library constructor
+__attribute__((constructor))
+static void memmgr_init(void)
+{
+  pthread_atfork(atfork_prepare, atfork_release, atfork_release);
+}
+
+/// @}
@@ -0,0 +1,768 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2020
+//
+/// @file
+/// @brief record the allocation trace of a program through library interpositioning
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+// Allocation recorder
+// ===================
+//
+// This library intercepts malloc(), calloc(), realloc(), and free() of an unmodified program and
+// records every call as a binary trace (see bintrace.h) that can be replayed with mm_replay or
+// turned into a .dmas script with 'dmas2bin -d'.
+//
+//   $ LD_PRELOAD=./libmmrecord.so <program> <args>
+//
+// The trace is written to '<prefix>.<pid>.bin' where <prefix> is taken from the environment
+// variable MMRECORD_PREFIX (default: 'mmrecord'). Every process (including forked children)
+// writes its own trace.
+//
+// Slot mapping:
+// -------------
+// Live pointers are mapped to dense slot ids through an open-addressing hash table. Slots of freed
+// blocks are recycled, so the number of slots equals the maximum number of live blocks. The map
+// is protected by a single mutex; the same critical section also assigns a global sequence
+// number to each operation.
+//
+// Buffering:
+// ----------
+// Records are appended to per-thread buffers without locking. Full buffers are handed to a
+// background thread that writes them to the trace file. Since buffers of different threads are
+// flushed out of order, the records carry their sequence number in the timestamp field; when the
+// process exits, the trace is sorted by sequence number and the header is finalized.
+//
+// An operation counts as in flight from the moment it is numbered (with map_mtx held and
+// recording enabled) until its record has been appended. The destructor disables recording
+// under map_mtx and then waits for the in-flight count to drop to zero before it writes out
+// the buffers, so no record is lost and no buffer is read while it is written to.
+//
+// Operations on pointers that were not allocated through the intercepted functions (e.g., by
+// memalign(), or before the recorder was loaded) are not recorded.
+//
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "bintrace.h"
+
+
+/// @name Macro definitions
+/// @{
+
+#define MIN(a, b)         ((a) < (b) ? (a) : (b))      ///< MIN function
+#define TLS               __thread __attribute__((tls_model("initial-exec")))
+
+#define BUF_RECORDS       4096                         ///< number of records per buffer
+#define MAP_INITIAL       (1 << 16)                    ///< initial size of pointer map
+#define BOOTSTRAP_SIZE    (64*1024)                    ///< size of bootstrap arena
+
+// pthread functions return the error code instead of setting errno
+#define LOCK(x)   do { int e_ = pthread_mutex_lock(x);                                       \
+                       if (e_ != 0) PANIC("LOCK: %s", strerror(e_)); } while (0)
+#define UNLOCK(x) do { int e_ = pthread_mutex_unlock(x);                                     \
+                       if (e_ != 0) PANIC("UNLOCK: %s", strerror(e_)); } while (0)
+/// @}
+
+
+/// @name structures
+/// @{
+
+/// @brief record buffer. Each thread owns one buffer at a time
+typedef struct __buffer {
+  struct __buffer *next;                                      ///< next buffer in queue/list
+  struct __buffer *all;                                       ///< next buffer in list of all
+  size_t          n;                                          ///< number of valid records
+  TraceRecord     rec[BUF_RECORDS];                           ///< records
+} Buffer;
+
+/// @brief pointer map entry
+typedef struct {
+  void     *ptr;                                              ///< live pointer (NULL: empty)
+  uint32_t slot;                                              ///< slot id
+  size_t   size;                                              ///< requested size
+} MapEntry;
+/// @}
+
+
+/// @name global variables
+/// @{
+
+static void* (*malloc_orig)(size_t) = NULL;
+static void* (*calloc_orig)(size_t, size_t) = NULL;
+static void* (*realloc_orig)(void*, size_t) = NULL;
+static void  (*free_orig)(void*) = NULL;
+
+static char bootstrap[BOOTSTRAP_SIZE] __attribute__((aligned(16))); ///< arena used by dlsym()
+static size_t bootstrap_used = 0;                             ///< used bytes in bootstrap arena
+static int resolving = 0;                                     ///< dlsym() in progress
+
+static volatile int recording = 0;                            ///< recording enabled
+static TLS int in_hook = 0;                                   ///< recursion guard
+static TLS Buffer *tbuf = NULL;                               ///< buffer of current thread
+
+static pthread_mutex_t map_mtx = PTHREAD_MUTEX_INITIALIZER;   ///< protects map, slots, stats
+static MapEntry *map = NULL;                                  ///< pointer map
+static size_t map_size = 0;                                   ///< number of map entries
+static size_t map_used = 0;                                   ///< number of live pointers
+static uint32_t *free_slots = NULL;                           ///< stack of recycled slots
+static size_t nfree_slots = 0;                                ///< number of recycled slots
+static uint32_t nslots = 0;                                   ///< number of slots handed out
+static uint64_t seq = 0;                                      ///< operation sequence number
+static unsigned long inflight = 0;                            ///< numbered ops not yet appended
+static size_t live_bytes = 0;                                 ///< currently allocated bytes
+static size_t peak_bytes = 0;                                 ///< peak allocated bytes
+
+static pthread_mutex_t q_mtx = PTHREAD_MUTEX_INITIALIZER;     ///< protects buffer queues
+static pthread_cond_t  q_cond = PTHREAD_COND_INITIALIZER;     ///< signals full buffers
+static Buffer *q_full = NULL;                                 ///< buffers ready to be written
+static Buffer *q_free = NULL;                                 ///< empty buffers
+static Buffer *q_all = NULL;                                  ///< all buffers owned by threads
+static pthread_t flusher;                                     ///< background flush thread
+static int flusher_running = 0;                               ///< flush thread started
+static int flusher_quit = 0;                                  ///< flush thread should terminate
+static pthread_key_t tbuf_key;                                ///< releases buffers at thread exit
+
+static int fd = -1;                                           ///< trace file
+static char fn[256];                                          ///< trace file name
+/// @}
+
+
+/// @brief Prints an error message and terminates the process. Does not return.
+/// @param fmt printf format string
+/// @param ... variadic parameters for @a fmt
+__attribute__((noreturn))
+static void PANIC(const char *fmt, ...)
+{
+  fprintf(stderr, "[mmrecord PANIC] ");
+
+  va_list va;
+  va_start(va, fmt);
+  vfprintf(stderr, fmt, va);
+  va_end(va);
+
+  fprintf(stderr, "\n");
+
+  _exit(EXIT_FAILURE);
+}
+
+
+//--------------------------------------------------------------------------------------------------
+/// @name trace file
+/// @{
+
+/// @brief write @a len bytes from @a buf to the trace file, opening it if necessary
+/// @param buf data
+/// @param len number of bytes
+static void write_file(const void *buf, size_t len)
+{
+  if (fd < 0) {
+    const char *prefix = getenv("MMRECORD_PREFIX");
+    TraceHeader hdr;
+
+    snprintf(fn, sizeof(fn), "%s.%d.bin", prefix ? prefix : "mmrecord", getpid());
+    fd = open(fn, O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0) PANIC("cannot open '%s': %s", fn, strerror(errno));
+
+    // placeholder header, finalized at exit
+    bt_init_header(&hdr);
+    write_file(&hdr, sizeof(hdr));
+  }
+
+  while (len > 0) {
+    ssize_t res = write(fd, buf, len);
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      PANIC("cannot write '%s': %s", fn, strerror(errno));
+    }
+    buf += res;
+    len -= res;
+  }
+}
+
+/// @brief qsort comparator ordering records by their sequence number
+static int record_compare(const void *a, const void *b)
+{
+  uint64_t s1 = ((const TraceRecord*)a)->ts, s2 = ((const TraceRecord*)b)->ts;
+
+  return (s1 > s2) - (s1 < s2);
+}
+
+/// @brief sort the records of the trace file by sequence number and write the final header
+static void finalize_file(void)
+{
+  if (fd < 0) return;
+
+  off_t len = lseek(fd, 0, SEEK_END);
+  if (len < (off_t)sizeof(TraceHeader)) PANIC("truncated trace '%s'", fn);
+
+  void *m = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED) PANIC("cannot map '%s': %s", fn, strerror(errno));
+
+  TraceHeader *hdr = m;
+  TraceRecord *rec = (TraceRecord*)(hdr + 1);
+  size_t nrec = (len - sizeof(TraceHeader)) / sizeof(TraceRecord);
+
+  qsort(rec, nrec, sizeof(TraceRecord), record_compare);
+
+  // make room for the replay allocator's overhead and fragmentation
+  size_t dataseg = 32*1024*1024;
+  while (dataseg < 4*peak_bytes) dataseg *= 2;
+
+  bt_init_header(hdr);
+  hdr->dataseg = dataseg;
+  hdr->mode    = bm_Performance;
+  hdr->flags   = BT_F_TIMESTAMP | BT_F_SEQUENCE;
+  hdr->nslots  = nslots;
+  hdr->nops    = nrec;
+
+  munmap(m, len);
+  close(fd);
+  fd = -1;
+}
+
+/// @}
+
+
+//--------------------------------------------------------------------------------------------------
+/// @name record buffers
+/// @{
+
+/// @brief background thread writing full buffers to the trace file
+static void* flush_thread(void *arg)
+{
+  in_hook = 1;
+
+  LOCK(&q_mtx);
+  while (1) {
+    while ((q_full == NULL) && !flusher_quit) pthread_cond_wait(&q_cond, &q_mtx);
+    if (q_full == NULL) break;
+
+    Buffer *b = q_full;
+    q_full = b->next;
+    UNLOCK(&q_mtx);
+
+    write_file(b->rec, b->n * sizeof(TraceRecord));
+
+    LOCK(&q_mtx);
+    b->n = 0;
+    b->next = q_free;
+    q_free = b;
+  }
+  UNLOCK(&q_mtx);
+
+  return NULL;
+}
+
+/// @brief get an empty buffer. Must be called with in_hook set
+/// @retval Buffer* empty buffer
+static Buffer* get_buffer(void)
+{
+  Buffer *b;
+
+  LOCK(&q_mtx);
+  if (q_free != NULL) {
+    b = q_free;
+    q_free = b->next;
+  } else {
+    b = malloc_orig(sizeof(Buffer));
+    if (b == NULL) PANIC("cannot allocate record buffer");
+    b->all = q_all;
+    q_all = b;
+  }
+  b->next = NULL;
+  b->n = 0;
+
+  if (!flusher_running) {
+    if (pthread_create(&flusher, NULL, flush_thread, NULL) != 0) {
+      PANIC("cannot create flush thread");
+    }
+    flusher_running = 1;
+  }
+  UNLOCK(&q_mtx);
+
+  return b;
+}
+
+/// @brief hand buffer @a b to the flush thread
+/// @param b buffer
+static void put_buffer(Buffer *b)
+{
+  LOCK(&q_mtx);
+  b->next = q_full;
+  q_full = b;
+  pthread_cond_signal(&q_cond);
+  UNLOCK(&q_mtx);
+}
+
+/// @brief thread destructor; flushes the buffer of an exiting thread
+static void release_buffer(void *arg)
+{
+  Buffer *b = arg;
+
+  if ((b != NULL) && (b == tbuf)) {
+    tbuf = NULL;
+    if (b->n > 0) put_buffer(b);
+    else {
+      LOCK(&q_mtx);
+      b->next = q_free;
+      q_free = b;
+      UNLOCK(&q_mtx);
+    }
+  }
+}
+
+/// @brief append a record to the buffer of the current thread and end the operation started by
+///        next_seq(). Must be called with in_hook set
+/// @param op operation
+/// @param slot slot id
+/// @param size size
+/// @param nelem number of elements (calloc)
+/// @param s sequence number returned by next_seq()
+static void append(TraceOp op, uint32_t slot, size_t size, size_t nelem, uint64_t s)
+{
+  if (tbuf == NULL) {
+    tbuf = get_buffer();
+    pthread_setspecific(tbuf_key, tbuf);
+  }
+
+  TraceRecord *r = &tbuf->rec[tbuf->n++];
+  r->op = op;
+  r->rsvd[0] = r->rsvd[1] = r->rsvd[2] = 0;
+  r->slot = slot;
+  r->size = size;
+  r->nelem = nelem;
+  r->ts = s;
+
+  if (tbuf->n == BUF_RECORDS) {
+    put_buffer(tbuf);
+    tbuf = get_buffer();
+    pthread_setspecific(tbuf_key, tbuf);
+  }
+
+  __atomic_sub_fetch(&inflight, 1, __ATOMIC_RELEASE);
+}
+
+/// @}
+
+
+/// @brief number the next operation and mark it in flight. Must be called with map_mtx held and
+///        recording enabled; the operation ends with append()
+/// @retval sequence number
+static inline uint64_t next_seq(void)
+{
+  __atomic_add_fetch(&inflight, 1, __ATOMIC_RELAXED);
+  return seq++;
+}
+
+/// @brief end an operation started by next_seq() without recording it
+static inline void drop_seq(void)
+{
+  __atomic_sub_fetch(&inflight, 1, __ATOMIC_RELEASE);
+}
+
+
+//--------------------------------------------------------------------------------------------------
+/// @name pointer map. All functions must be called with map_mtx held
+/// @{
+
+/// @brief hash function for pointers
+#define HASH(p) ((((uintptr_t)(p) >> 4) * 0x9e3779b97f4a7c15ULL) >> 17)
+
+/// @brief find the map index of pointer @a ptr
+/// @param ptr pointer
+/// @retval index of entry holding @a ptr or of the empty entry where it would be inserted
+static size_t map_find(void *ptr)
+{
+  size_t mask = map_size - 1;
+  size_t i = HASH(ptr) & mask;
+
+  while ((map[i].ptr != NULL) && (map[i].ptr != ptr)) i = (i+1) & mask;
+
+  return i;
+}
+
+/// @brief double the size of the pointer map
+static void map_grow(void)
+{
+  MapEntry *old = map;
+  size_t old_size = map_size;
+
+  map_size = map_size ? 2*map_size : MAP_INITIAL;
+  map = calloc_orig(map_size, sizeof(MapEntry));
+  if (map == NULL) PANIC("cannot allocate pointer map");
+
+  for (size_t i = 0; i < old_size; i++) {
+    if (old[i].ptr != NULL) map[map_find(old[i].ptr)] = old[i];
+  }
+
+  free_orig(old);
+}
+
+/// @brief insert pointer @a ptr into the map
+/// @param ptr pointer
+/// @param size requested size
+/// @param slot slot id to use or UINT32_MAX to assign a new slot
+/// @retval slot id
+static uint32_t map_insert(void *ptr, size_t size, uint32_t slot)
+{
+  if (2*(map_used+1) > map_size) map_grow();
+
+  if (slot == UINT32_MAX) {
+    slot = nfree_slots > 0 ? free_slots[--nfree_slots] : nslots++;
+  }
+
+  size_t i = map_find(ptr);
+  if (map[i].ptr == NULL) map_used++;
+  else live_bytes -= map[i].size;                  // stale entry, block was freed behind our back
+  map[i].ptr  = ptr;
+  map[i].slot = slot;
+  map[i].size = size;
+
+  live_bytes += size;
+  if (live_bytes > peak_bytes) peak_bytes = live_bytes;
+
+  return slot;
+}
+
+/// @brief return slot @a slot to the free slot stack
+/// @param slot slot id
+static void slot_recycle(uint32_t slot)
+{
+  // free_slots never holds more than nslots entries
+  static size_t free_slots_size = 0;
+  if (nfree_slots == free_slots_size) {
+    free_slots_size = free_slots_size ? 2*free_slots_size : 1024;
+    free_slots = realloc_orig(free_slots, free_slots_size*sizeof(uint32_t));
+    if (free_slots == NULL) PANIC("cannot allocate slot stack");
+  }
+  free_slots[nfree_slots++] = slot;
+}
+
+/// @brief remove pointer @a ptr from the map
+/// @param ptr pointer
+/// @param recycle return the slot to the free slot stack
+/// @param[out] size receives the requested size of @a ptr (may be NULL)
+/// @retval slot id of @a ptr
+/// @retval UINT32_MAX if @a ptr is not in the map
+static uint32_t map_remove(void *ptr, int recycle, size_t *size)
+{
+  size_t mask = map_size - 1;
+  size_t i = map_find(ptr);
+
+  if (map[i].ptr == NULL) return UINT32_MAX;
+
+  uint32_t slot = map[i].slot;
+  if (size != NULL) *size = map[i].size;
+  live_bytes -= map[i].size;
+  map_used--;
+
+  // backward-shift deletion (linear probing)
+  size_t j = i;
+  while (1) {
+    map[i].ptr = NULL;
+    do {
+      j = (j+1) & mask;
+      if (map[j].ptr == NULL) goto done;
+      size_t k = HASH(map[j].ptr) & mask;
+      if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j))) continue;
+      break;
+    } while (1);
+    map[i] = map[j];
+    i = j;
+  }
+done:
+
+  if (recycle) slot_recycle(slot);
+
+  return slot;
+}
+
+/// @}
+
+
+//--------------------------------------------------------------------------------------------------
+/// @name malloc/calloc/realloc/free intercepts
+/// @{
+
+/// @brief resolve the original functions. Allocations made by dlsym() itself are served from
+///        the bootstrap arena
+static void resolve(void)
+{
+  resolving = 1;
+  malloc_orig  = dlsym(RTLD_NEXT, "malloc");
+  calloc_orig  = dlsym(RTLD_NEXT, "calloc");
+  realloc_orig = dlsym(RTLD_NEXT, "realloc");
+  free_orig    = dlsym(RTLD_NEXT, "free");
+  resolving = 0;
+
+  if (!malloc_orig || !calloc_orig || !realloc_orig || !free_orig) {
+    PANIC("cannot resolve allocation functions");
+  }
+}
+
+/// @brief allocate from the bootstrap arena
+/// @param size size in bytes
+/// @retval void* zeroed memory
+static void* bootstrap_alloc(size_t size)
+{
+  size = (size + 15) & ~15UL;
+  if (bootstrap_used + size > sizeof(bootstrap)) return NULL;
+
+  void *p = &bootstrap[bootstrap_used];
+  bootstrap_used += size;
+
+  return p;
+}
+
+/// @brief check whether @a p lies in the bootstrap arena
+#define IS_BOOTSTRAP(p) (((char*)(p) >= bootstrap) && ((char*)(p) < bootstrap + sizeof(bootstrap)))
+
+/// @brief malloc intercept. See malloc(3)
+void* malloc(size_t size)
+{
+  if (malloc_orig == NULL) {
+    if (resolving) return bootstrap_alloc(size);
+    resolve();
+  }
+
+  void *p = malloc_orig(size);
+
+  if (recording && !in_hook && (p != NULL)) {
+    in_hook = 1;
+    LOCK(&map_mtx);
+    int rec = recording;
+    uint32_t slot = 0;
+    uint64_t s = 0;
+    if (rec) {
+      slot = map_insert(p, size, UINT32_MAX);
+      s = next_seq();
+    }
+    UNLOCK(&map_mtx);
+    if (rec) append(op_Malloc, slot, size, 0, s);
+    in_hook = 0;
+  }
+
+  return p;
+}
+
+/// @brief calloc intercept. See calloc(3)
+void* calloc(size_t nelem, size_t size)
+{
+  if (calloc_orig == NULL) {
+    if (resolving) return bootstrap_alloc(nelem*size);
+    resolve();
+  }
+
+  void *p = calloc_orig(nelem, size);
+
+  if (recording && !in_hook && (p != NULL)) {
+    in_hook = 1;
+    LOCK(&map_mtx);
+    int rec = recording;
+    uint32_t slot = 0;
+    uint64_t s = 0;
+    if (rec) {
+      slot = map_insert(p, nelem*size, UINT32_MAX);
+      s = next_seq();
+    }
+    UNLOCK(&map_mtx);
+    if (rec) append(op_Calloc, slot, size, nelem, s);
+    in_hook = 0;
+  }
+
+  return p;
+}
+
+/// @brief realloc intercept. See realloc(3)
+void* realloc(void *ptr, size_t size)
+{
+  if (realloc_orig == NULL) {
+    if (resolving) return NULL;
+    resolve();
+  }
+
+  if (IS_BOOTSTRAP(ptr)) {
+    // blocks from the bootstrap arena are never freed; copy them to a real block
+    void *p = malloc(size);
+    if (p != NULL) memcpy(p, ptr, MIN(size, (size_t)(bootstrap + sizeof(bootstrap) - (char*)ptr)));
+    return p;
+  }
+
+  if (!recording || in_hook) return realloc_orig(ptr, size);
+  if (ptr == NULL) return malloc(size);
+
+  in_hook = 1;
+
+  // like free(), unmap the old block and number the operation before the allocator may hand
+  // out ptr again to another thread
+  uint32_t slot = UINT32_MAX;
+  size_t osize = 0;
+  uint64_t s = 0;
+
+  LOCK(&map_mtx);
+  int rec = recording;
+  if (rec) {
+    slot = map_remove(ptr, 0, &osize);
+    s = next_seq();
+  }
+  UNLOCK(&map_mtx);
+
+  void *p = realloc_orig(ptr, size);
+
+  if (rec) {
+    LOCK(&map_mtx);
+    if (p != NULL) {
+      // moved or resized block; an unknown block is recorded as fresh allocation
+      slot = map_insert(p, size, slot);
+    } else if (slot != UINT32_MAX) {
+      // realloc(ptr, 0) freed the block; on failure, the old block is still valid
+      if (size == 0) slot_recycle(slot);
+      else map_insert(ptr, osize, slot);
+    }
+    UNLOCK(&map_mtx);
+
+    if (p != NULL) append(op_Realloc, slot, size, 0, s);
+    else if ((slot != UINT32_MAX) && (size == 0)) append(op_Free, slot, 0, 0, s);
+    else drop_seq();
+  }
+  in_hook = 0;
+
+  return p;
+}
+
+/// @brief free intercept. See free(3)
+void free(void *ptr)
+{
+  if ((ptr == NULL) || IS_BOOTSTRAP(ptr)) return;
+  if (free_orig == NULL) resolve();
+
+  if (recording && !in_hook) {
+    in_hook = 1;
+    uint32_t slot = UINT32_MAX;
+    uint64_t s = 0;
+    LOCK(&map_mtx);
+    if (recording) {
+      slot = map_remove(ptr, 1, NULL);
+      if (slot != UINT32_MAX) s = next_seq();
+    }
+    UNLOCK(&map_mtx);
+    if (slot != UINT32_MAX) append(op_Free, slot, 0, 0, s);
+    in_hook = 0;
+  }
+
+  free_orig(ptr);
+}
+
+/// @}
+
+
+//--------------------------------------------------------------------------------------------------
+/// @name fork handling and library constructor/destructor
+/// @{
+
+/// @brief fork prepare handler: make sure no lock is held while forking
+static void atfork_prepare(void)
+{
+  LOCK(&map_mtx);
+  LOCK(&q_mtx);
+}
+
+/// @brief fork handler (parent)
+static void atfork_parent(void)
+{
+  UNLOCK(&q_mtx);
+  UNLOCK(&map_mtx);
+}
+
+/// @brief fork handler (child): start a fresh trace. The child's copies of pending records
+///        belong to the parent's trace and are dropped
+static void atfork_child(void)
+{
+  map_used = 0;
+  if (map != NULL) memset(map, 0, map_size*sizeof(MapEntry));
+  nfree_slots = 0;
+  nslots = 0;
+  seq = 0;
+  inflight = 0;
+  live_bytes = peak_bytes = 0;
+
+  q_full = NULL;
+  for (Buffer *b = q_all; b != NULL; b = b->all) {
+    b->n = 0;
+    if (b != tbuf) {
+      b->next = q_free;
+      q_free = b;
+    }
+  }
+  flusher_running = 0;
+  flusher_quit = 0;
+
+  if (fd >= 0) close(fd);
+  fd = -1;
+
+  UNLOCK(&q_mtx);
+  UNLOCK(&map_mtx);
+}
+
+/// @brief library constructor: start recording
+__attribute__((constructor))
+static void mmrecord_init(void)
+{
+  if (malloc_orig == NULL) resolve();
+
+  in_hook = 1;
+  if (pthread_key_create(&tbuf_key, release_buffer) != 0) PANIC("cannot create thread key");
+  pthread_atfork(atfork_prepare, atfork_parent, atfork_child);
+  in_hook = 0;
+
+  recording = 1;
+}
+
+/// @brief library destructor: stop recording, write pending records, and finalize the trace
+__attribute__((destructor))
+static void mmrecord_fini(void)
+{
+  in_hook = 1;
+
+  // stop numbering operations, then wait until those in flight have been appended
+  LOCK(&map_mtx);
+  recording = 0;
+  UNLOCK(&map_mtx);
+  while (__atomic_load_n(&inflight, __ATOMIC_ACQUIRE) > 0) sched_yield();
+
+  LOCK(&q_mtx);
+  int running = flusher_running;
+  flusher_quit = 1;
+  pthread_cond_signal(&q_cond);
+  UNLOCK(&q_mtx);
+
+  if (running) pthread_join(flusher, NULL);
+
+  // write partially filled buffers of all threads
+  for (Buffer *b = q_all; b != NULL; b = b->all) {
+    if (b->n > 0) write_file(b->rec, b->n * sizeof(TraceRecord));
+    b->n = 0;
+  }
+
+  if (fd >= 0) {
+    finalize_file();
+    fprintf(stderr, "[mmrecord] %lu operations, %u slots recorded to '%s'.\n",
+            (unsigned long)seq, nslots, fn);
+  }
+}
+
+/// @}
@@ -37,21 +37,79 @@
 //                       |                                         |
 //               32-byte aligned                           32-byte aligned
 //
-// - allocation policies: first, next, best fit
+// - allocation policies: first, next, best fit, and adaptive
 // - block splitting: always at 32-byte boundaries
 // - immediate coalescing upon free
 //
+// Statistics:
+// -----------
+// All statistics reported by mm_stats() are updated by the operations themselves; the heap is
+// never traversed to compute them.
+// - operation counts, heap size, and expansions are simple counters.
+// - free blocks are accounted for in free_count[], holding the number of free blocks for each
+//   block size (in units of BS). free_count_hi[] sums up FREE_GROUP consecutive entries of
+//   free_count[], so the largest free block is found by scanning free_count_hi[] and one group
+//   of free_count[] from the top. The counters are mapped on demand and sized according to the
+//   maximal heap size; only pages covering block sizes that actually occur are backed by memory.
+// - the block search functions count the blocks they examine and record the result in a
+//   histogram with logarithmic buckets.
+//
+// Adaptive policy:
+// ----------------
+// ap_Adaptive starts with next fit, which is fast while the heap is mostly used for new blocks.
+// After every 'window' searches, the policy compares the blocks examined per search (a throughput
+// measure) and the heap utilization (in_use / heap_size, a memory measure) against the budgets
+// set with mm_setadaptive() and switches between next fit and best fit:
+// - next fit -> best fit if the utilization fell below min_util
+// - best fit -> next fit if the searches exceed max_examined and the utilization is at least
+//   ADAPT_HYSTERESIS above min_util (otherwise we would immediately switch back)
+// In adaptive mode, a failed next fit search is retried once from heap_start before the heap is
+// expanded, and the rover is reset when switching to next fit; the plain next fit policy does
+// neither. Switches are recorded in the statistics (see mm_stats()).
+//
+// Compile-time configuration:
+// ---------------------------
+// The geometry of the heap and the allocation policy can be fixed at compile time:
+// - MM_TYPE       word type of boundary tags (default: unsigned long). 'unsigned int' halves the
+//                 tag overhead, but limits the heap to 4 GB and aligns payloads to 4 bytes only
+// - MM_BS         block size / alignment in bytes; a power of 2, at least 8 and 2 words (default 32)
+// - MM_CHUNKSIZE  minimal heap expansion in bytes (default 4096)
+// - MM_POLICY     allocation policy (ap_FirstFit, ap_NextFit, ap_BestFit, ap_Adaptive). If defined,
+//                 the search function is called directly instead of through get_block, so the
+//                 compiler inlines the search loop into alloc_block; mm_init() ignores its
+//                 argument. The default build selects the policy at runtime.
+// The diagrams in this file show the default geometry. 'make variants' builds mm_replay for every
+// (policy, block size) combination; tools/variant_bench.sh compares them on the same traces.
+//
+// Validation:
+// -----------
+// mm_validate() checks the heap silently and returns the number of errors. The full mode walks
+// the heap and checks the boundary tags of every block, that no two free blocks are adjacent,
+// and that the free block accounting and the next fit rover agree with the heap. There is no
+// explicit free list; the free block counters and the rover are the structures the policies rely
+// on. The incremental mode only checks last_block (the block created or coalesced by the last
+// operation), its neighbors, and the rover in O(1).
+//
+// Logging and tracing:
+// ---------------------
+// LOG() is only used on cold paths (initialization, errors). The allocation operations record
+// binary events with EVT()/EVT2() instead (see evtrace.h); these compile to nothing unless the
+// memory manager is built with event tracing enabled (make EVTRACE=1 or EVTRACE=2).
+//
 
 
 #include <assert.h>
 #include <error.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include "dataseg.h"
+#include "evtrace.h"
 #include "memmgr.h"
 
 void mm_check(void);
@@ -67,11 +125,32 @@ static int  mm_loglevel    = 0;                        ///< log level (0: off; 1
 static void *nextfit_start = NULL;                    /// search start from here when next fit allocation, renewal when every search of blocks for allocating, and coalescing
 
 static void* (*get_block)(size_t) = NULL;             /// function pointer for allocation policy
+static void *last_block    = NULL;                    ///< block modified by the last operation
+
+static struct mm_stats stats;                         ///< allocator statistics
+static uint32_t *free_count    = NULL;                ///< number of free blocks per size (BS units)
+static uint32_t *free_count_hi = NULL;                ///< free_count[] summed up per FREE_GROUP
+static size_t   free_count_len = 0;                   ///< number of entries in free_count[]
+static size_t   free_count_map = 0;                   ///< size of counter mapping in bytes
+
+/// @brief state of the adaptive allocation policy
+static struct {
+  unsigned long window;                               ///< searches between evaluations
+  double max_examined;                                ///< throughput budget
+  double min_util;                                    ///< utilization budget
+  unsigned long searches;                             ///< stats.searches at start of window
+  unsigned long examined;                             ///< stats.examined at start of window
+} adaptive = { 256, 64.0, 0.7, 0, 0 };
 
 
 #define MAX(a, b)          ((a) > (b) ? (a) : (b))     ///< MAX function
+#define MIN(a, b)          ((a) < (b) ? (a) : (b))     ///< MIN function
 
+#ifdef MM_TYPE
+#define TYPE               MM_TYPE                     ///< word type of heap
+#else
 #define TYPE               unsigned long               ///< word type of heap
+#endif
 #define TYPE_SIZE          sizeof(TYPE)                ///< size of word type
 
 #define ALLOC              1                           ///< block allocated flag
@@ -79,15 +158,28 @@ static void* (*get_block)(size_t) = NULL;             /// function pointer for a
 #define STATUS_MASK        ((TYPE)(0x7))               ///< mask to retrieve flagsfrom header/footer
 #define SIZE_MASK          (~STATUS_MASK)              ///< mask to retrieve size from header/footer
 
+#ifdef MM_CHUNKSIZE
+#define CHUNKSIZE          (MM_CHUNKSIZE)              ///< size by which heap is extended
+#else
 #define CHUNKSIZE          (1*(1 << 12))               ///< size by which heap is extended
+#endif
 
+#ifdef MM_BS
+#define BS                 (MM_BS)                     ///< minimal block size. Must be a power of 2
+#else
 #define BS                 32                          ///< minimal block size. Must be a power of 2
+#endif
 #define BS_MASK            (~(BS-1))                   ///< alignment mask
 
+_Static_assert((BS & (BS-1)) == 0, "BS must be a power of 2");
+_Static_assert(BS >= 8, "BS must leave the three status bits of a boundary tag free");
+_Static_assert(BS >= 2*sizeof(TYPE), "BS must hold at least a header and a footer");
+_Static_assert(CHUNKSIZE % BS == 0, "CHUNKSIZE must be a multiple of BS");
+
 #define ROUND_UP(w)        (((w)+BS-1)/BS*BS)          
 #define ROUND_DOWN(w)      ((w)/BS*BS)         
 
-#define WORD(p)            ((TYPE)(p))                 ///< convert pointer to TYPE
+#define WORD(p)            ((uintptr_t)(p))            ///< convert pointer to integer
 #define PTR(w)             ((void*)(w))                ///< convert TYPE to void*
 
 #define PREV_PTR(p)        ((p)-TYPE_SIZE)             ///< get pointer to word preceeding p
@@ -106,6 +198,10 @@ static void* (*get_block)(size_t) = NULL;             /// function pointer for a
 #define NEXT_BLOCK(p)     ((p)+GET_SIZE(p))             /// get next block of p
 #define PREV_BLOCK(p)     ((p)-GET_SIZE((p)-TYPE_SIZE))  /// get previous block of p
 
+#define FREE_GROUP         1024                        ///< free_count[] entries per free_count_hi[]
+
+#define ADAPT_HYSTERESIS   0.1                         ///< utilization margin to leave best fit
+
 
 // TODO add more macros as needed
 
@@ -155,9 +251,55 @@ static void mm_panic(const char *func, ...)
   exit(EXIT_FAILURE);
 }
 
-static void* nf_get_free_block(size_t size){
 
-  LOG(1, "nf_get_free_block(0x%lx (%lu))", size, size);
+/// @brief set up statistics for a heap of at most @a max_size bytes
+/// @param max_size maximal size of the heap in bytes
+static void stats_init(size_t max_size)
+{
+  if (free_count != NULL) munmap(free_count, free_count_map);
+
+  free_count_len = max_size / BS + 1;
+  free_count_map = (free_count_len + free_count_len/FREE_GROUP + 1) * sizeof(uint32_t);
+  free_count = mmap(NULL, free_count_map, PROT_READ|PROT_WRITE,
+                    MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if (free_count == MAP_FAILED) PANIC("Cannot map free block counters.");
+  free_count_hi = free_count + free_count_len;
+
+  memset(&stats, 0, sizeof(stats));
+}
+
+/// @brief account for a new free block of @a size bytes
+static inline void stats_free_insert(size_t size)
+{
+  free_count[size/BS]++;
+  free_count_hi[size/BS/FREE_GROUP]++;
+  stats.free_bytes += size;
+  stats.free_blocks++;
+}
+
+/// @brief account for the removal (allocation or coalescing) of a free block of @a size bytes
+static inline void stats_free_remove(size_t size)
+{
+  free_count[size/BS]--;
+  free_count_hi[size/BS/FREE_GROUP]--;
+  stats.free_bytes -= size;
+  stats.free_blocks--;
+}
+
+/// @brief record a block search that examined @a n blocks
+static inline void stats_search(unsigned long n)
+{
+  unsigned int bucket = n < 2 ? 0 : 8*sizeof(n)-1 - __builtin_clzl(n);
+
+  if (bucket >= MM_SEARCH_BUCKETS) bucket = MM_SEARCH_BUCKETS-1;
+
+  stats.searches++;
+  stats.examined += n;
+  stats.search_hist[bucket]++;
+}
+
+
+static void* nf_get_free_block(size_t size){
 
   assert(mm_initialized);
 
@@ -165,19 +307,20 @@ static void* nf_get_free_block(size_t size){
   void *block = (nextfit_start == NULL) ? heap_start : nextfit_start;
   //TODO needs next_block variable
   size_t bsize, bstatus;
+  unsigned long examined = 0;
 
-  LOG(2, "  starting search at %p", block);
   do {
+    examined++;
     bstatus = GET_STATUS(block);
     bsize = GET_SIZE(block);
 
-    LOG(2, "    %p: size: %lx (%lu), status: %s",
-        block, bsize, bsize, bstatus == ALLOC ? "allocated" : "free");
+    EVT2(ev_Examine, block, GET(block), 0);
 
     if ((bstatus == FREE) && (bsize >= size)) {
       //found block
-      LOG(2, "  --> match");
       nextfit_start = block;
+      stats_search(examined);
+      EVT(ev_Search, block, bsize, examined);
       return block;
     }
 
@@ -186,30 +329,29 @@ static void* nf_get_free_block(size_t size){
    }while (GET_SIZE(block) >0); // size 0 means the sentinel at the end
 
   //no block found
-  LOG(2, "  no suitable block found");
+  stats_search(examined);
+  EVT(ev_Search, NULL, size, examined);
   return NULL;
 
 }
 
 static void* bf_get_free_block(size_t size)
 {
-  LOG(1, "bf_get_free_block(0x%lx (%lu))", size, size);
-
   assert(mm_initialized);
 
   // best fit
   void *block = heap_start;
   size_t bsize, bstatus;
   void *best_block = NULL;
-  size_t best_size;
+  size_t best_size = 0;
+  unsigned long examined = 0;
 
-  LOG(2, "  starting search at %p", block);
   do {
+    examined++;
     bstatus = GET_STATUS(block);
     bsize = GET_SIZE(block);
 
-    LOG(2, "    %p: size: %lx (%lu), status: %s",
-        block, bsize, bsize, bstatus == ALLOC ? "allocated" : "free");
+    EVT2(ev_Examine, block, GET(block), 0);
 
     if ((bstatus == FREE) && (bsize >= size)){
       // can be our block, should compare the size
@@ -230,10 +372,12 @@ static void* bf_get_free_block(size_t size)
     block += bsize;
    }while (GET_SIZE(block) >0); // size 0 means the sentinel at the end
 
+  stats_search(examined);
+  EVT(ev_Search, best_block, best_block ? best_size : size, examined);
+
   // check if the block is found and return the best-fit block
   if (best_block == NULL){
   //no block found
-  LOG(2, "  no suitable block found");
   return NULL; 
   }
   else {
@@ -244,26 +388,25 @@ static void* bf_get_free_block(size_t size)
 
 static void* ff_get_free_block(size_t size)
 {
-  LOG(1, "ff_get_free_block(0x%lx (%lu))", size, size);
-
   assert(mm_initialized);
 
   // first fit
   void *block = heap_start;
   size_t bsize, bstatus;
+  unsigned long examined = 0;
 
-  LOG(2, "  starting search at %p", block);
   do {
+    examined++;
     bstatus = GET_STATUS(block);
     bsize = GET_SIZE(block);
 
-    LOG(2, "    %p: size: %lx (%lu), status: %s",
-        block, bsize, bsize, bstatus == ALLOC ? "allocated" : "free");
+    EVT2(ev_Examine, block, GET(block), 0);
 
     if ((bstatus == FREE) && (bsize >= size)) {
       //found block
-      LOG(2, "  --> match");
       nextfit_start = block;
+      stats_search(examined);
+      EVT(ev_Search, block, bsize, examined);
       return block;
     }
 
@@ -272,20 +415,106 @@ static void* ff_get_free_block(size_t size)
    }while (GET_SIZE(block) >0); // size 0 means the sentinel at the end
 
   //no block found
-  LOG(2, "  no suitable block found");
+  stats_search(examined);
+  EVT(ev_Search, NULL, size, examined);
   return NULL;
 }
 
+/// @brief switch the adaptive policy to @a ap and log the switch
+/// @param ap new policy (ap_NextFit or ap_BestFit)
+/// @param avg blocks examined per search in the last window
+/// @param util current heap utilization
+static void ad_switch(AllocationPolicy ap, double avg, double util)
+{
+  int i = stats.switches++ % MM_SWITCH_LOG;
+
+  stats.switch_log[i].search       = stats.searches;
+  stats.switch_log[i].to           = ap;
+  stats.switch_log[i].avg_examined = avg;
+  stats.switch_log[i].utilization  = util;
+
+  stats.active = ap;
+  if (ap == ap_NextFit) nextfit_start = NULL;
+
+  LOG(1, "adaptive policy: switching to %s (%.1f blocks/search, utilization %.2f)",
+      ap == ap_NextFit ? "next fit" : "best fit", avg, util);
+  EVT(ev_Switch, NULL, ap, stats.switches);
+}
+
+/// @brief evaluate the last window of searches and switch the policy if a budget is exceeded
+static void ad_evaluate(void)
+{
+  double avg = (double)(stats.examined - adaptive.examined) / (stats.searches - adaptive.searches);
+  size_t heap_size = heap_end - heap_start;
+  double util = (double)(heap_size - stats.free_bytes) / heap_size;
+
+  adaptive.searches = stats.searches;
+  adaptive.examined = stats.examined;
+
+  if (stats.active == ap_NextFit) {
+    if (util < adaptive.min_util) ad_switch(ap_BestFit, avg, util);
+  } else {
+    if ((avg > adaptive.max_examined) && (util >= adaptive.min_util + ADAPT_HYSTERESIS)) {
+      ad_switch(ap_NextFit, avg, util);
+    }
+  }
+}
+
+static void* ad_get_free_block(size_t size)
+{
+  void *block = (stats.active == ap_NextFit) ? nf_get_free_block(size) : bf_get_free_block(size);
+
+  // next fit: wrap around once before the caller expands the heap
+  if ((block == NULL) && (stats.active == ap_NextFit) &&
+      (nextfit_start != NULL) && (nextfit_start != heap_start)) {
+    nextfit_start = NULL;
+    block = nf_get_free_block(size);
+  }
+
+  if (stats.searches - adaptive.searches >= adaptive.window) ad_evaluate();
+
+  return block;
+}
+
+#ifdef MM_POLICY
+/// @brief search function of the policy fixed at compile time. The switch is resolved by the
+///        compiler, leaving a direct (and inlinable) call
+static inline void* policy_get_free_block(size_t size)
+{
+  switch (MM_POLICY) {
+    case ap_NextFit:  return nf_get_free_block(size);
+    case ap_BestFit:  return bf_get_free_block(size);
+    case ap_Adaptive: return ad_get_free_block(size);
+    default:          return ff_get_free_block(size);
+  }
+}
+#define GET_BLOCK(size)    policy_get_free_block(size)  ///< search a free block
+#else
+#define GET_BLOCK(size)    get_block(size)              ///< search a free block
+#endif
+
+void mm_setadaptive(unsigned long window, double max_examined, double min_util)
+{
+  adaptive.window       = window > 0 ? window : 1;
+  adaptive.max_examined = max_examined;
+  adaptive.min_util     = min_util;
+}
+
 void mm_init(AllocationPolicy ap)
 {
   LOG(1, "mm_init(%d)", ap);
 
   // figure out allocation policy
+#ifdef MM_POLICY
+  if (ap != MM_POLICY) LOG(1, "  policy fixed at compile time; using policy %d", MM_POLICY);
+  ap = MM_POLICY;
+#endif
 
   switch (ap) {
     case ap_FirstFit:get_block = ff_get_free_block; break;
     case ap_NextFit:get_block = nf_get_free_block; break;
     case ap_BestFit:get_block = bf_get_free_block; break;
+    case ap_Adaptive:get_block = ad_get_free_block; break;
     default: PANIC("Invalid Allocation Policy.");
   }
 
@@ -293,7 +522,8 @@ void mm_init(AllocationPolicy ap)
   //
   // retrieve heap status and perform a few initial sanity checks
   //
-  ds_heap_stat(&ds_heap_start, &ds_heap_brk, NULL);
+  void *ds_heap_max;
+  ds_heap_stat(&ds_heap_start, &ds_heap_brk, &ds_heap_max);
   PAGESIZE = ds_getpagesize();
 
   LOG(2, "  ds_heap_start    %p\n"
@@ -305,6 +535,17 @@ void mm_init(AllocationPolicy ap)
   if (ds_heap_start != ds_heap_brk) PANIC("Heap not clean.");
   if (PAGESIZE == 0) PANIC("Reported pagesize == 0.");
 
+  stats_init(ds_heap_max - ds_heap_start);
+  stats.policy = ap;
+  stats.active = ap;
+
+  if (ap == ap_Adaptive) {
+    stats.active = ap_NextFit;
+    adaptive.searches = adaptive.examined = 0;
+  }
+  nextfit_start = NULL;
+  last_block = NULL;
+
   // get first chunk of memory for heap
   LOG(2, "Get first block of memory for heap");
 
@@ -336,6 +577,11 @@ void mm_init(AllocationPolicy ap)
   PUT(heap_start, bdrytag);
   PUT(heap_end-TYPE_SIZE, bdrytag);
 
+  stats_free_insert(size);
+  stats.peak_heap_size = size;
+  last_block = heap_start;
+  EVT(ev_Init, heap_start, size, ap);
+
   //
   // heap is initialized
   //
@@ -345,30 +591,27 @@ void mm_init(AllocationPolicy ap)
 
 static void coalesce(void *block)
 {
-  LOG(1, "coalesce(%p)", block);
-
   assert(mm_initialized);
   assert(GET_STATUS(block) == FREE);
 
-  TYPE size = GET_SIZE(block);
+  TYPE bsize = GET_SIZE(block);
+  TYPE size = bsize;
   void *hdr = block;
   void *ftr = HDR2FTR(hdr);
+  int merged = 0;
 
   // coalesce with next block
   if (NEXT_BLOCK(block)!=block && GET_STATUS(NEXT_BLOCK(block)) == FREE){
-    LOG(2, "  coalescing with sucedding block.");
-    LOG(2,"block: %p, next block: %p, nextfit_start: %p", block, NEXT_BLOCK(block),nextfit_start);
-
     size += GET_SIZE(NEXT_BLOCK(block));
     ftr = hdr + size - TYPE_SIZE;
+    stats_free_remove(GET_SIZE(NEXT_BLOCK(block)));
+    merged |= 1;
   }
 
   if (size > GET_SIZE(block)) {
      if (NEXT_BLOCK(block) == nextfit_start){
     // if next block was a next fit start, change start point
     nextfit_start = block;
-    LOG(2, "  Now nextfit_start is %p.", nextfit_start);
-
     }  
     PUT(hdr, PACK(size, FREE));
     PUT(ftr, PACK(size, FREE));
@@ -377,91 +620,110 @@ static void coalesce(void *block)
 
   // coalesce with preceeding block
   if (PREV_BLOCK(block)!=block && GET_STATUS(PREV_BLOCK(block)) == FREE){
-    LOG(2, "  coalescing with preceeding  block.");
-    LOG(2,"block: %p, previous  block: %p, nextfit_start: %p", block, PREV_BLOCK(block),nextfit_start);
     size += GET_SIZE(PREV_BLOCK(block));
     hdr = PREV_BLOCK(block);
+    stats_free_remove(GET_SIZE(hdr));
+    merged |= 2;
   }
 
   if (size > GET_SIZE(block)) {
     // if current block was a next fit start, change start point
     if (block == nextfit_start){
       nextfit_start = PREV_BLOCK(block);
-     LOG(2, "  Now nextfit_start is %p.", nextfit_start);
    }
     PUT(hdr, PACK(size, FREE));
     PUT(ftr, PACK(size, FREE));
   }
-}
 
-/// @brief expand heap
-void  expand_heap() 
-{
+  last_block = hdr;
 
-  LOG(2, "Trying to expand heap...");
+  // replace the (already accounted) freed block by the coalesced one
+  if (size > bsize) {
+    stats_free_remove(bsize);
+    stats_free_insert(size);
+    EVT(ev_Coalesce, hdr, size, merged);
+  }
+}
 
+/// @brief expand heap by at least @a size bytes (rounded up to CHUNKSIZE)
+/// @param size minimal number of bytes to add to the heap
+/// @retval 0 on success
+/// @retval -1 if the data segment cannot be grown
+static int expand_heap(size_t size)
+{
   //find the very last free block
   void *last_block = PREV_BLOCK(heap_end);
 
   //expand heap by sbrk function
-  if(ds_sbrk(CHUNKSIZE)==(void*)-1) PANIC("Cannot increase heap break.");
+  size_t increment = MAX(CHUNKSIZE, (size + CHUNKSIZE-1) / CHUNKSIZE * CHUNKSIZE);
+  if (ds_sbrk(increment) == (void*)-1) {
+    LOG(1, "  cannot increase heap break.");
+    EVT(ev_Expand, heap_end, increment, 1);
+    return -1;
+  }
   ds_heap_brk = ds_sbrk(0);
 
-  LOG(2, "Yay! Break is now at %p!", ds_heap_brk);
+  EVT(ev_Expand, heap_end, increment, 0);
 
   //make a new big free block and handle some strange things
   
   heap_end   = PTR((WORD(ds_heap_brk) - TYPE_SIZE         ) / BS * BS);
 
-  LOG(2, "   heap_start at   %p\n"
-        "   heap_end at     %p\n",
-        heap_start, heap_end);
-
   // write end sentinel half-block
   TYPE H = PACK(0, ALLOC);
   PUT(heap_end, H);
 
   // write free block
-  TYPE size = heap_end - NEXT_BLOCK(last_block); //TODO
- TYPE bdrytag = PACK(size, FREE);
+  TYPE bsize = heap_end - NEXT_BLOCK(last_block);
+  TYPE bdrytag = PACK(bsize, FREE);
 
   PUT(NEXT_BLOCK(last_block), bdrytag);
   PUT(heap_end-TYPE_SIZE, bdrytag); 
 
+  stats_free_insert(bsize);
+  stats.expand_heap++;
+  stats.peak_heap_size = MAX(stats.peak_heap_size, (size_t)(heap_end - heap_start));
+
   //coalece two blocks
   if (GET_STATUS(last_block) == FREE){
   coalesce(last_block);
-  LOG(2, "coalesce");
   }
+
+  return 0;
 }
 
 
-void* mm_malloc(size_t size)
+/// @brief allocate a block with a payload of @a size bytes. Shared by mm_malloc, mm_calloc, and
+///        mm_realloc so that each call is counted once in the statistics
+/// @param size requested size in bytes
+/// @retval void* pointer to payload
+/// @retval NULL if the allocation failed
+static void* alloc_block(size_t size)
 {
-  LOG(1, "mm_malloc(0x%lx (%lu))", size, size);
-
-  assert(mm_initialized);
+  // reject sizes whose block size would overflow
+  if (size > (size_t)SIZE_MASK - 2*TYPE_SIZE - BS) {
+    stats.failed++;
+    return NULL;
+  }
  
   // compute block size (header + payload + footer, round up to BS)
   size_t blocksize = ROUND_UP(TYPE_SIZE + size + TYPE_SIZE);
-  LOG(2, "  blocksize:      %lx (%lu)", blocksize, blocksize);
 
   // find free block
-  void *block =  get_block(blocksize);
-
-  LOG(2, "  got free block: %p", block);
+  void *block =  GET_BLOCK(blocksize);
 
   if (block == NULL) {
-    // no free block is big enough -> expand heap
-    
-   // LOG(2, "  expand_heap is not implemented"); return NULL;
-    
-     expand_heap();
-     return mm_malloc(size);
+    // no free block is big enough -> expand heap. The new area alone is big enough.
+    if (expand_heap(blocksize) == 0) block = GET_BLOCK(blocksize);
+    if (block == NULL) {
+      stats.failed++;
+      return NULL;
+    }
   }
 
   // split block
   size_t bsize = GET_SIZE(block);
+  stats_free_remove(bsize);
   if (blocksize < bsize) {
 
     void *next_block = block + blocksize;
@@ -469,66 +731,129 @@ void* mm_malloc(size_t size)
 
     PUT(next_block, PACK(next_size, FREE)); //header of next block
     PUT(next_block + next_size - TYPE_SIZE, PACK(next_size, FREE));
+    stats_free_insert(next_size);
+    EVT(ev_Split, next_block, next_size, 0);
   }
 
   PUT(block, PACK(blocksize, ALLOC));
   PUT(block+blocksize-TYPE_SIZE, PACK(blocksize, ALLOC));
+  last_block = block;
 
   //pointer to payload
   return block+TYPE_SIZE;
 }
 
-void* mm_calloc(size_t nmemb, size_t size)
+/// @brief free the block with payload @a ptr. Shared by mm_free and mm_realloc
+/// @param ptr pointer to payload
+static void free_block(void *ptr)
 {
-  LOG(1, "mm_calloc(0x%lx, 0x%lx)", nmemb, size);
+  if (ptr == NULL) return;
+
+  void *block = ptr - TYPE_SIZE;
+
+  // check if it is allocated
+  if (GET_STATUS(block) != ALLOC){
+  LOG(1, "  WARNING: double-free detected");
+  EVT(ev_DoubleFree, ptr, 0, 0);
+  return;
+  }
 
+  // free in header and footer is enough
+  TYPE size = GET_SIZE(block);
+  PUT(block, PACK(size, FREE));
+  PUT(block+size-TYPE_SIZE, PACK(size, FREE));
+  stats_free_insert(size);
+  EVT(ev_Free, ptr, size, 0);
+
+  // coalesce
+  coalesce(block);
+}
+
+void* mm_malloc(size_t size)
+{
+  assert(mm_initialized);
+
+  stats.malloc++;
+
+  void *payload = alloc_block(size);
+  EVT(ev_Malloc, payload, size, 0);
+
+  return payload;
+}
+
+void* mm_calloc(size_t nmemb, size_t size)
+{
   assert(mm_initialized);
 
+  stats.calloc++;
+
+  // check for overflow of nmemb * size
+  if ((size != 0) && (nmemb > SIZE_MAX / size)) {
+    stats.failed++;
+    EVT(ev_Calloc, NULL, SIZE_MAX, 0);
+    return NULL;
+  }
+
   //
   // calloc is simply malloc() followed by memset()
   //
-  void *payload = mm_malloc(nmemb * size);
+  void *payload = alloc_block(nmemb * size);
 
   if (payload != NULL) memset(payload, 0, nmemb * size);
+  EVT(ev_Calloc, payload, nmemb * size, 0);
 
   return payload;
 }
 
 void* mm_realloc(void *ptr, size_t size)
 {
-  LOG(1, "mm_realloc(%p, 0x%lx)", ptr, size);
-
   assert(mm_initialized);
 
-  // realloc is just free and "re" allocate it
-  mm_free(ptr);
-  return mm_malloc(size);
+  stats.realloc++;
+
+  void *nptr = NULL;
+
+  if (ptr == NULL) {
+    nptr = alloc_block(size);
+  } else if (size == 0) {
+    free_block(ptr);
+  } else if (size <= mm_usable_size(ptr)) {
+    // the current block is big enough -> nothing to do
+    last_block = ptr - TYPE_SIZE;
+    EVT(ev_Realloc, ptr, size, 1);
+    return ptr;
+  } else {
+    // otherwise allocate a new block, copy the payload, and free the old block
+    nptr = alloc_block(size);
+    if (nptr != NULL) {
+      memcpy(nptr, ptr, mm_usable_size(ptr));
+      free_block(ptr);
+    }
+  }
+
+  EVT(ev_Realloc, nptr, size, 0);
+
+  return nptr;
 }
 
 
-void mm_free(void *ptr)
+size_t mm_usable_size(void *ptr)
 {
-  LOG(1, "mm_free(%p)", ptr);
-
   assert(mm_initialized);
 
-  //TODO
-  
-  void *block = ptr - TYPE_SIZE;
+  if (ptr == NULL) return 0;
 
-  // check if it is allocated
-  if (GET_STATUS(block) != ALLOC){
-  LOG(1, "  WARNING: double-free detected");
-  return;
-  }
+  return GET_SIZE(ptr - TYPE_SIZE) - 2*TYPE_SIZE;
+}
 
-  // free in header and footer is enough
-  TYPE size = GET_SIZE(block);
-  PUT(block, PACK(size, FREE));
-  PUT(block+size-TYPE_SIZE, PACK(size, FREE));
 
-  // coalesce
-  coalesce(block);
+void mm_free(void *ptr)
+{
+  assert(mm_initialized);
+
+  stats.free++;
+
+  free_block(ptr);
 }
 
 
@@ -539,6 +864,28 @@ void mm_setloglevel(int level)
 }
 
 
+void mm_stats(struct mm_stats *s)
+{
+  assert(mm_initialized);
+
+  *s = stats;
+  s->heap_size = heap_end - heap_start;
+  s->in_use = s->heap_size - s->free_bytes;
+
+  // find the largest free block: first the highest non-empty group, then the entry in the group
+  s->largest_free = 0;
+  for (size_t hi = free_count_len/FREE_GROUP + 1; (hi-- > 0) && (s->largest_free == 0); ) {
+    if (free_count_hi[hi] == 0) continue;
+
+    size_t i = MIN((hi+1)*FREE_GROUP, free_count_len);
+    while ((i-- > hi*FREE_GROUP) && (free_count[i] == 0));
+    s->largest_free = i*BS;
+  }
+
+  s->fragmentation = s->free_bytes > 0 ? 1.0 - (double)s->largest_free / s->free_bytes : 0.0;
+}
+
+
 void mm_check(void)
 {
   assert(mm_initialized);
@@ -553,9 +900,11 @@ void mm_check(void)
   printf("  nextfit_start:          %p\n", nextfit_start);
   printf("\n");
   p = PREV_PTR(heap_start);
-  printf("  initial sentinel:       %p: size: %6lx, status: %lx\n", p, GET_SIZE(p), GET_STATUS(p));
+  printf("  initial sentinel:       %p: size: %6lx, status: %lx\n",
+         p, (unsigned long)GET_SIZE(p), (unsigned long)GET_STATUS(p));
   p = heap_end;
-  printf("  end sentinel:           %p: size: %6lx, status: %lx\n", p, GET_SIZE(p), GET_STATUS(p));
+  printf("  end sentinel:           %p: size: %6lx, status: %lx\n",
+         p, (unsigned long)GET_SIZE(p), (unsigned long)GET_STATUS(p));
   printf("\n");
   printf("  blocks:\n");
 
@@ -565,7 +914,7 @@ void mm_check(void)
     TYPE hdr = GET(p);
     TYPE size = SIZE(hdr);
     TYPE status = STATUS(hdr);
-    printf("    %p: size: %6lx, status: %lx\n", p, size, status);
+    printf("    %p: size: %6lx, status: %lx\n", p, (unsigned long)size, (unsigned long)status);
 
     void *fp = p + size - TYPE_SIZE;
     TYPE ftr = GET(fp);
@@ -575,7 +924,7 @@ void mm_check(void)
     if ((size != fsize) || (status != fstatus)) {
       errors++;
       printf("    --> ERROR: footer at %p with different properties: size: %lx, status: %lx\n", 
-             fp, fsize, fstatus);
+             fp, (unsigned long)fsize, (unsigned long)fstatus);
     }
 
     p = p + size;
@@ -589,3 +938,108 @@ void mm_check(void)
   if ((p == heap_end) && (errors == 0)) printf("  Block structure coherent.\n");
   printf("-------------------------------------------------------------------------------------------------\n");
 }
+
+
+/// @brief check the block at @a p: it must lie inside the heap, be aligned, have a non-zero size
+///        that is a multiple of BS, and a footer identical to its header
+/// @param p block header
+/// @retval 0 if the block is valid
+/// @retval 1 otherwise
+static int check_block(void *p)
+{
+  if ((p < heap_start) || (p >= heap_end) || (WORD(p) % BS != 0)) return 1;
+
+  TYPE hdr = GET(p);
+  TYPE size = SIZE(hdr);
+  if ((size == 0) || (size % BS != 0) || (size > (TYPE)(heap_end - p))) return 1;
+
+  return GET(p + size - TYPE_SIZE) != hdr;
+}
+
+/// @brief check the sentinels, the free block accounting, and the next fit rover in O(1)
+static int check_globals(void)
+{
+  int errors = 0;
+  size_t heap_size = heap_end - heap_start;
+
+  if (GET(PREV_PTR(heap_start)) != PACK(0, ALLOC)) errors++;
+  if (GET(heap_end) != PACK(0, ALLOC)) errors++;
+
+  if ((stats.free_bytes > heap_size) || (stats.free_blocks * BS > stats.free_bytes)) errors++;
+
+  if ((nextfit_start != NULL) && (nextfit_start != heap_end) && check_block(nextfit_start)) {
+    errors++;
+  }
+
+  return errors;
+}
+
+int mm_validate(ValidateMode mode)
+{
+  assert(mm_initialized);
+
+  int errors = check_globals();
+
+  if (mode == vm_Incremental) {
+    // last_block, its neighbors, and the block after the next one (a split remainder must not
+    // border on a free block either)
+    void *p = last_block;
+    if ((p == NULL) || (p == heap_end)) return errors;
+    if (check_block(p)) return errors + 1;
+
+    TYPE status = GET_STATUS(p);
+    if (p > heap_start) {
+      void *prev = PREV_BLOCK(p);
+      if (check_block(prev)) errors++;
+      else if ((status == FREE) && (GET_STATUS(prev) == FREE)) errors++;
+    }
+
+    void *next = NEXT_BLOCK(p);
+    if (next < heap_end) {
+      if (check_block(next)) return errors + 1;
+      if ((status == FREE) && (GET_STATUS(next) == FREE)) errors++;
+
+      void *nnext = NEXT_BLOCK(next);
+      if ((nnext < heap_end) && (GET_STATUS(next) == FREE) && (GET_STATUS(nnext) == FREE)) {
+        errors++;
+      }
+    }
+
+    return errors;
+  }
+
+  // full walk
+  size_t free_bytes = 0;
+  unsigned long free_blocks = 0;
+  int rover_found = (nextfit_start == NULL) || (nextfit_start == heap_end);
+  TYPE prev_status = ALLOC;
+  void *p = heap_start;
+
+  while (p < heap_end) {
+    if (check_block(p)) {
+      // the size cannot be trusted; stop here
+      return errors + 1;
+    }
+
+    TYPE size = GET_SIZE(p);
+    TYPE status = GET_STATUS(p);
+
+    if (status == FREE) {
+      if (prev_status == FREE) errors++;
+      free_bytes += size;
+      free_blocks++;
+    } else if (status != ALLOC) {
+      errors++;
+    }
+    if (p == nextfit_start) rover_found = 1;
+
+    prev_status = status;
+    p += size;
+  }
+
+  if (p != heap_end) errors++;
+  if ((free_bytes != stats.free_bytes) || (free_blocks != stats.free_blocks)) errors++;
+  if (!rover_found) errors++;
+
+  return errors;
+}
@@ -41,12 +41,84 @@ typedef enum {
   ap_FirstFit,                    ///< first fit allocation policy
   ap_NextFit,                     ///< next fit allocation policy
   ap_BestFit,                     ///< best fit allocation policy
+  ap_Adaptive,                    ///< switches between next fit and best fit at runtime
 } AllocationPolicy;
 
+/// @brief heap validation modes (see mm_validate())
+typedef enum {
+  vm_Full,                        ///< check the entire heap
+  vm_Incremental,                 ///< check the neighborhood of the last operation only
+} ValidateMode;
+
+/// @brief number of buckets in the search length histogram
+#define MM_SEARCH_BUCKETS 24
+
+/// @brief number of policy switches kept in the switch log of the adaptive policy
+#define MM_SWITCH_LOG 16
+
+/// @brief allocator statistics (see mm_stats())
+struct mm_stats {
+  AllocationPolicy policy;        ///< allocation policy passed to mm_init()
+
+  /// @name operation counts
+  /// @{
+  unsigned long malloc;           ///< number of mm_malloc() calls
+  unsigned long calloc;           ///< number of mm_calloc() calls
+  unsigned long realloc;          ///< number of mm_realloc() calls
+  unsigned long free;             ///< number of mm_free() calls
+  unsigned long failed;           ///< number of failed allocations
+  /// @}
+
+  /// @name heap
+  /// @{
+  size_t heap_size;               ///< current heap size (heap_start..heap_end) in bytes
+  size_t peak_heap_size;          ///< maximum heap size in bytes
+  unsigned long expand_heap;      ///< number of heap expansions
+  size_t in_use;                  ///< bytes in allocated blocks (incl. boundary tags)
+  size_t free_bytes;              ///< bytes in free blocks
+  unsigned long free_blocks;      ///< number of free blocks
+  size_t largest_free;            ///< size of largest free block in bytes
+  double fragmentation;           ///< external fragmentation: 1 - largest_free / free_bytes
+  /// @}
+
+  /// @name block search
+  /// @{
+  unsigned long searches;         ///< number of free block searches
+  unsigned long examined;         ///< total number of blocks examined by all searches
+  unsigned long search_hist[MM_SEARCH_BUCKETS];
+                                  ///< histogram of blocks examined per search. Bucket 0 counts
+                                  ///< searches examining 0 or 1 blocks, bucket i>0 those
+                                  ///< examining 2^i .. 2^(i+1)-1 blocks (last bucket: more)
+  /// @}
+
+  /// @name adaptive policy
+  /// @{
+  AllocationPolicy active;        ///< policy currently used for block searches
+  unsigned long switches;         ///< number of policy switches
+  struct {
+    unsigned long search;         ///< number of searches performed before the switch
+    AllocationPolicy to;          ///< new policy
+    double avg_examined;          ///< blocks examined per search in the last window
+    double utilization;           ///< heap utilization (in_use / heap_size) at the switch
+  } switch_log[MM_SWITCH_LOG];    ///< the most recent switches. Entry i is stored at index
+                                  ///< i % MM_SWITCH_LOG
+  /// @}
+};
+
 /// @brief initialize heap. Must be called before any of the other functions can be used.
 /// @param ap block allocation policy
 void mm_init(AllocationPolicy ap);
 
+/// @brief configure the budgets of the adaptive allocation policy. The policy starts with next fit
+///        and re-evaluates its choice after every @a window searches: if the heap utilization
+///        drops below @a min_util, it switches to best fit; if best fit examines more than
+///        @a max_examined blocks per search while the utilization is comfortably above the
+///        budget, it switches back to next fit. Can be called at any time.
+/// @param window number of searches between evaluations (default: 256)
+/// @param max_examined throughput budget: average blocks examined per search (default: 64)
+/// @param min_util utilization budget: minimal in_use / heap_size (default: 0.7)
+void mm_setadaptive(unsigned long window, double max_examined, double min_util);
+
 /// @brief allocate a block of memory of @a size bytes
 /// @param size requested size in bytes
 /// @retval void* pointer to first byte of memory on success
@@ -67,6 +139,12 @@ void* mm_calloc(size_t nelem, size_t size);
 /// @retval NULL if memory allocation failed
 void* mm_realloc(void *ptr, size_t size);
 
+/// @brief return the number of usable payload bytes of an allocated block
+/// @param ptr pointer to allocated memory obtained by calling mm_malloc, mm_calloc, or mm_realloc
+/// @retval size_t usable size in bytes (>= the requested size)
+/// @retval 0 if @a ptr is NULL
+size_t mm_usable_size(void *ptr);
+
 /// @brief free a previously allocated block of memory
 /// @param ptr pointer to allocated memory obtained by calling mm_malloc, mm_calloc, or mm_realloc
 void mm_free(void *ptr);
@@ -75,7 +153,20 @@ void mm_free(void *ptr);
 /// @brief level log level (0: no logging, 1: info; 2: verbose)
 void mm_setloglevel(int level);
 
+/// @brief retrieve allocator statistics. All counters are maintained by the allocator operations;
+///        this function does not traverse the heap.
+/// @param[out] stats statistics since the last mm_init()
+void mm_stats(struct mm_stats *stats);
+
 /// @brief dump heap and perform some sanity checks
 void mm_check(void);
 
+/// @brief validate the heap without printing anything. Checks that headers and footers agree,
+///        that no two free blocks are adjacent, and that the free block statistics and the next
+///        fit rover are consistent with the heap. vm_Full traverses the heap; vm_Incremental
+///        only checks the block modified by the last operation and its neighbors in O(1).
+/// @param mode validation mode
+/// @retval int number of errors found (0: heap is consistent)
+int mm_validate(ValidateMode mode);
+
 #endif // __MEMMGR_H__
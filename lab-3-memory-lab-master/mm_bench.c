@@ -0,0 +1,484 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2020
+//
+/// @file
+/// @brief multithreaded allocator benchmark: memmgr vs. the C library's malloc
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+// Allocator benchmark
+// ===================
+// mm_bench runs allocation patterns with 1..N threads on two allocators and reports throughput,
+// scaling efficiency, and peak memory usage:
+//
+// Allocators:
+//   memmgr   our memory manager. It is not thread-safe, so every call is serialized by one lock.
+//   system   malloc/free of the C library
+//
+// Patterns:
+//   loop     every thread allocates and frees blocks in a private window of WINDOW slots
+//   prodcons thread i allocates blocks and passes them through a queue to thread i+1 (mod n),
+//            which frees them. All frees are remote for n > 1.
+//   larson   every thread replaces random blocks in a private array of LARSON_SLOTS blocks.
+//            After each round, the arrays are passed on to the next thread (Larson & Krishnan).
+//
+// Every run (pattern, allocator, thread count) is executed in a child process so that the peak
+// resident set size (ru_maxrss) and the heap of one run do not influence the next.
+//
+// ops/sec counts allocations and frees. The scaling efficiency of a run with n threads is
+// ops/sec(n) / (n * ops/sec(1)).
+//
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bintrace.h"
+#include "dataseg.h"
+#include "memmgr.h"
+
+
+/// @name Macro definitions
+/// @{
+
+#define MAX_THREADS       64                           ///< maximal number of threads
+#define WINDOW            64                           ///< slots per thread in 'loop'
+#define QUEUE_SIZE        1024                         ///< queue capacity in 'prodcons'. Power of 2
+#define LARSON_SLOTS      1000                         ///< slots per thread in 'larson'
+#define LARSON_ROUNDS     10                           ///< array hand-offs in 'larson'
+/// @}
+
+
+/// @brief allocator under test
+typedef struct {
+  const char *name;                                    ///< allocator name
+  void* (*malloc)(size_t);                             ///< allocate a block
+  void  (*free)(void*);                                ///< free a block
+} Allocator;
+
+/// @brief single-producer/single-consumer queue
+typedef struct {
+  void           *slot[QUEUE_SIZE];                    ///< queued blocks
+  _Atomic size_t head;                                 ///< next slot to pop (consumer)
+  _Atomic size_t tail;                                 ///< next slot to push (producer)
+  _Atomic int    done;                                 ///< producer finished
+} __attribute__((aligned(64))) Queue;
+
+/// @brief benchmark configuration and shared state of a run
+typedef struct {
+  const Allocator *alloc;                              ///< allocator
+  int             nthreads;                            ///< number of threads
+  unsigned long   nops;                                ///< allocations per thread
+  size_t          min_size;                            ///< minimal block size
+  size_t          max_size;                            ///< maximal block size
+  pthread_barrier_t barrier;                           ///< start/round barrier
+  Queue           *queue;                              ///< queues ('prodcons')
+  void            **larson[MAX_THREADS];               ///< slot arrays ('larson')
+} Run;
+
+/// @brief per-thread arguments
+typedef struct {
+  Run           *run;                                  ///< run
+  int           id;                                    ///< thread index
+  unsigned int  seed;                                  ///< random seed
+  unsigned long ops;                                   ///< number of operations performed
+  struct timespec start;                               ///< time the measured part started
+  struct timespec stop;                                ///< time the measured part ended
+} Worker;
+
+
+//--------------------------------------------------------------------------------------------------
+/// @name Allocators
+/// @{
+
+static pthread_mutex_t mm_mtx = PTHREAD_MUTEX_INITIALIZER;    ///< serializes memmgr calls
+
+/// @brief mm_malloc() behind the global lock
+static void* locked_malloc(size_t size)
+{
+  pthread_mutex_lock(&mm_mtx);
+  void *ptr = mm_malloc(size);
+  pthread_mutex_unlock(&mm_mtx);
+
+  return ptr;
+}
+
+/// @brief mm_free() behind the global lock
+static void locked_free(void *ptr)
+{
+  pthread_mutex_lock(&mm_mtx);
+  mm_free(ptr);
+  pthread_mutex_unlock(&mm_mtx);
+}
+
+/// @brief allocators, in the order they are benchmarked
+static const Allocator allocators[] = {
+  { "system", malloc,        free        },
+  { "memmgr", locked_malloc, locked_free },
+};
+
+#define NALLOCATORS (sizeof(allocators)/sizeof(allocators[0]))
+
+/// @}
+
+
+/// @brief random block size in [min_size, max_size]
+/// @param r run
+/// @param seed random state of the calling thread
+static inline size_t rnd_size(const Run *r, unsigned int *seed)
+{
+  return r->min_size + rand_r(seed) % (r->max_size - r->min_size + 1);
+}
+
+
+//--------------------------------------------------------------------------------------------------
+/// @name Patterns
+/// @{
+
+/// @brief 'loop': allocate and free blocks in a private window
+static void* pattern_loop(void *arg)
+{
+  Worker *w = arg;
+  Run *r = w->run;
+  void *slot[WINDOW] = { NULL };
+
+  pthread_barrier_wait(&r->barrier);
+  clock_gettime(CLOCK_MONOTONIC, &w->start);
+
+  for (unsigned long i = 0; i < r->nops; i++) {
+    unsigned int k = rand_r(&w->seed) % WINDOW;
+
+    if (slot[k] != NULL) {
+      r->alloc->free(slot[k]);
+      w->ops++;
+    }
+    slot[k] = r->alloc->malloc(rnd_size(r, &w->seed));
+    w->ops++;
+  }
+
+  for (int k = 0; k < WINDOW; k++) {
+    if (slot[k] != NULL) {
+      r->alloc->free(slot[k]);
+      w->ops++;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &w->stop);
+
+  return NULL;
+}
+
+/// @brief pop a block from queue @a q and free it
+/// @retval 1 if a block was freed
+/// @retval 0 if the queue was empty
+static int consume(Worker *w, Queue *q)
+{
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+  if (head == atomic_load_explicit(&q->tail, memory_order_acquire)) return 0;
+
+  w->run->alloc->free(q->slot[head & (QUEUE_SIZE-1)]);
+  atomic_store_explicit(&q->head, head+1, memory_order_release);
+  w->ops++;
+
+  return 1;
+}
+
+/// @brief 'prodcons': allocate into the own queue, free from the previous thread's queue
+static void* pattern_prodcons(void *arg)
+{
+  Worker *w = arg;
+  Run *r = w->run;
+  Queue *out = &r->queue[w->id];
+  Queue *in  = &r->queue[(w->id + r->nthreads-1) % r->nthreads];
+  unsigned long produced = 0;
+
+  pthread_barrier_wait(&r->barrier);
+  clock_gettime(CLOCK_MONOTONIC, &w->start);
+
+  while (produced < r->nops) {
+    size_t tail = atomic_load_explicit(&out->tail, memory_order_relaxed);
+    int progress = 0;
+
+    if (tail - atomic_load_explicit(&out->head, memory_order_acquire) < QUEUE_SIZE) {
+      out->slot[tail & (QUEUE_SIZE-1)] = r->alloc->malloc(rnd_size(r, &w->seed));
+      atomic_store_explicit(&out->tail, tail+1, memory_order_release);
+      produced++;
+      w->ops++;
+      progress = 1;
+    }
+
+    // do not spin on a full queue and an empty queue when there are more threads than CPUs
+    if (!consume(w, in) && !progress) sched_yield();
+  }
+  atomic_store_explicit(&out->done, 1, memory_order_release);
+
+  // drain the incoming queue until its producer is done
+  for (;;) {
+    int done = atomic_load_explicit(&in->done, memory_order_acquire);
+    if (!consume(w, in)) {
+      if (done) break;
+      sched_yield();
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &w->stop);
+
+  return NULL;
+}
+
+/// @brief 'larson': replace random blocks in a slot array that is handed on after every round
+static void* pattern_larson(void *arg)
+{
+  Worker *w = arg;
+  Run *r = w->run;
+  unsigned long per_round = r->nops / LARSON_ROUNDS;
+
+  // fill own array before the clock starts
+  void **slot = r->larson[w->id];
+  for (int k = 0; k < LARSON_SLOTS; k++) slot[k] = r->alloc->malloc(rnd_size(r, &w->seed));
+
+  pthread_barrier_wait(&r->barrier);
+  clock_gettime(CLOCK_MONOTONIC, &w->start);
+
+  for (int round = 0; round < LARSON_ROUNDS; round++) {
+    slot = r->larson[(w->id + round) % r->nthreads];
+
+    for (unsigned long i = 0; i < per_round; i++) {
+      unsigned int k = rand_r(&w->seed) % LARSON_SLOTS;
+
+      r->alloc->free(slot[k]);
+      slot[k] = r->alloc->malloc(rnd_size(r, &w->seed));
+      w->ops += 2;
+    }
+
+    // wait until all threads are done with their arrays before passing them on
+    pthread_barrier_wait(&r->barrier);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &w->stop);
+
+  return NULL;
+}
+
+/// @brief pattern table
+static const struct {
+  const char *name;                                    ///< pattern name
+  void* (*func)(void*);                                ///< thread function
+} patterns[] = {
+  { "loop",     pattern_loop     },
+  { "prodcons", pattern_prodcons },
+  { "larson",   pattern_larson   },
+};
+
+#define NPATTERNS (sizeof(patterns)/sizeof(patterns[0]))
+
+/// @}
+
+
+//--------------------------------------------------------------------------------------------------
+/// @name Runs
+/// @{
+
+/// @brief execute one run in the calling (child) process
+/// @param r run configuration
+/// @param pattern pattern index
+/// @retval double ops/sec
+static double execute(Run *r, int pattern)
+{
+  pthread_t tid[MAX_THREADS];
+  Worker w[MAX_THREADS];
+
+  pthread_barrier_init(&r->barrier, NULL, r->nthreads + 1);
+
+  r->queue = aligned_alloc(64, r->nthreads * sizeof(Queue));
+  memset(r->queue, 0, r->nthreads * sizeof(Queue));
+  for (int i = 0; i < r->nthreads; i++) r->larson[i] = calloc(LARSON_SLOTS, sizeof(void*));
+
+  for (int i = 0; i < r->nthreads; i++) {
+    w[i] = (Worker){ .run = r, .id = i, .seed = 1 + i, .ops = 0 };
+    pthread_create(&tid[i], NULL, patterns[pattern].func, &w[i]);
+  }
+
+  pthread_barrier_wait(&r->barrier);
+
+  // larson: keep pace with the workers' round barriers
+  if (patterns[pattern].func == pattern_larson) {
+    for (int round = 0; round < LARSON_ROUNDS; round++) pthread_barrier_wait(&r->barrier);
+  }
+
+  // the run lasts from the first thread starting to the last thread finishing. The threads take
+  // their own timestamps; the main thread may be descheduled right after the start barrier.
+  unsigned long ops = 0;
+  double start = 0.0, stop = 0.0;
+  for (int i = 0; i < r->nthreads; i++) {
+    pthread_join(tid[i], NULL);
+    ops += w[i].ops;
+
+    double t0 = w[i].start.tv_sec + w[i].start.tv_nsec / 1e9;
+    double t1 = w[i].stop.tv_sec + w[i].stop.tv_nsec / 1e9;
+    if ((i == 0) || (t0 < start)) start = t0;
+    if ((i == 0) || (t1 > stop)) stop = t1;
+  }
+
+  return ops / (stop - start);
+}
+
+/// @brief execute one run in a child process
+/// @param r run configuration
+/// @param pattern pattern index
+/// @param dataseg data segment size for memmgr
+/// @param policy allocation policy for memmgr
+/// @param[out] maxrss peak resident set size of the child in KB
+/// @retval double ops/sec
+/// @retval -1.0 if the run failed
+static double run_child(Run *r, int pattern, size_t dataseg, AllocationPolicy policy,
+                        long *maxrss)
+{
+  int fd[2];
+  double result = -1.0;
+
+  fflush(stdout);
+  if (pipe(fd) < 0) return -1.0;
+
+  pid_t pid = fork();
+  if (pid < 0) return -1.0;
+
+  if (pid == 0) {
+    close(fd[0]);
+
+    if (r->alloc->malloc == locked_malloc) {
+      ds_allocate(dataseg);
+      mm_init(policy);
+    }
+
+    result = execute(r, pattern);
+    if (write(fd[1], &result, sizeof(result)) != sizeof(result)) exit(EXIT_FAILURE);
+    exit(EXIT_SUCCESS);
+  }
+
+  close(fd[1]);
+  if (read(fd[0], &result, sizeof(result)) != sizeof(result)) result = -1.0;
+  close(fd[0]);
+
+  int status;
+  struct rusage ru;
+  if ((wait4(pid, &status, 0, &ru) != pid) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    result = -1.0;
+  }
+  *maxrss = ru.ru_maxrss;
+
+  return result;
+}
+
+/// @}
+
+
+/// @brief print program syntax and exit
+/// @param argv0 program name
+static void syntax(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-t <threads>] [-p <pattern>] [-a <allocator>] [-n <ops>] "
+                  "[-s <min>,<max>]\n"
+                  "       [-P <policy>] [-d <size>]\n"
+                  "Benchmark memmgr (behind a global lock) and the C library's malloc with 1..N "
+                  "threads.\n"
+                  "\n"
+                  "Options:\n"
+                  " -t <threads>   maximal number of threads (default: number of CPUs, max %d)\n"
+                  " -p <pattern>   loop, prodcons, larson, or all (default)\n"
+                  " -a <allocator> memmgr, system, or all (default)\n"
+                  " -n <ops>       allocations per thread (default: 100000)\n"
+                  " -s <min>,<max> range of block sizes in bytes (default: 16,512)\n"
+                  " -P <policy>    memmgr allocation policy (default: firstfit)\n"
+                  " -d <size>      memmgr data segment size (default: 1 GB)\n",
+                  basename((char*)argv0), MAX_THREADS);
+
+  exit(EXIT_FAILURE);
+}
+
+
+/// @brief program entry point
+int main(int argc, char *argv[])
+{
+  int maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  const char *pattern = "all", *allocator = "all";
+  unsigned long nops = 100000, min_size = 16, max_size = 512;
+  int policy = ap_FirstFit;
+  size_t dataseg = 1UL << 30;
+
+  //
+  // parse arguments
+  //
+  for (int i = 1; i < argc; i++) {
+    if ((argv[i][0] != '-') || (argv[i][1] == '\0') || (argv[i][2] != '\0') || (i+1 >= argc)) {
+      syntax(argv[0]);
+    }
+    const char *arg = argv[++i];
+
+    switch (argv[i-1][1]) {
+      case 't': maxthreads = atoi(arg); break;
+      case 'p': pattern = arg; break;
+      case 'a': allocator = arg; break;
+      case 'n': nops = strtoul(arg, NULL, 0); break;
+      case 's':
+        if ((sscanf(arg, "%lu,%lu", &min_size, &max_size) != 2) || (min_size > max_size)) {
+          syntax(argv[0]);
+        }
+        break;
+      case 'P': if ((policy = bt_policy_parse(arg)) < 0) syntax(argv[0]); break;
+      case 'd': dataseg = strtoul(arg, NULL, 0); break;
+      default:  syntax(argv[0]);
+    }
+  }
+
+  if (maxthreads < 1) maxthreads = 1;
+  if (maxthreads > MAX_THREADS) maxthreads = MAX_THREADS;
+  if (nops < LARSON_ROUNDS) nops = LARSON_ROUNDS;
+
+  //
+  // run benchmarks
+  //
+  printf("%-10s %-8s %7s %14s %10s %12s\n",
+         "pattern", "alloc", "threads", "ops/sec", "scaling", "maxrss [KB]");
+
+  int matched = 0;
+  for (size_t p = 0; p < NPATTERNS; p++) {
+    if (strcmp(pattern, "all") && strcmp(pattern, patterns[p].name)) continue;
+
+    for (size_t a = 0; a < NALLOCATORS; a++) {
+      if (strcmp(allocator, "all") && strcmp(allocator, allocators[a].name)) continue;
+      matched++;
+
+      double single = 0.0;
+      for (int n = 1; n <= maxthreads; n++) {
+        Run r = { .alloc = &allocators[a], .nthreads = n, .nops = nops,
+                  .min_size = min_size, .max_size = max_size };
+        long maxrss = 0;
+
+        double opss = run_child(&r, p, dataseg, policy, &maxrss);
+        if (opss < 0) {
+          printf("%-10s %-8s %7d %14s\n", patterns[p].name, allocators[a].name, n, "FAILED");
+          continue;
+        }
+        if (n == 1) single = opss;
+
+        printf("%-10s %-8s %7d %14.0f %9.1f%% %12ld\n",
+               patterns[p].name, allocators[a].name, n, opss,
+               single > 0 ? 100.0 * opss / (n * single) : 0.0, maxrss);
+      }
+    }
+  }
+
+  if (matched == 0) syntax(argv[0]);
+
+  return EXIT_SUCCESS;
+}
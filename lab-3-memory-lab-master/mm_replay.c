@@ -0,0 +1,299 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2020
+//
+/// @file
+/// @brief replay compiled binary traces on the dynamic memory manager
+/// @author Woorim Shin
+/// @studid 2018-13947
+//--------------------------------------------------------------------------------------------------
+
+// Trace replay
+// ============
+// mm_replay maps a binary trace produced by dmas2bin into memory and executes its operations
+// on our dynamic memory manager. Since the records are consumed straight from the mapping, the
+// measured time covers only the mm_malloc/mm_calloc/mm_realloc/mm_free calls themselves.
+//
+// Settings from the trace header (data segment size, allocation policy, execution mode) can be
+// overridden on the command line.
+//
+// The 'v' command validates the heap silently with mm_validate(): the full heap in correctness
+// mode, only the neighborhood of the last operation in performance mode (O(1), so validation can
+// stay enabled while measuring). The number of errors is reported after the replay.
+//
+// After the replay, the operation counts and the allocator statistics (heap size, fragmentation,
+// search lengths; see mm_stats()) are printed like by the 'stat' command of mm_driver.
+//
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bintrace.h"
+#include "dataseg.h"
+#include "evtrace.h"
+#include "memmgr.h"
+
+
+/// @brief validation modes of the 'v' command
+enum { val_Off = -1, val_Full = vm_Full, val_Incremental = vm_Incremental };
+
+/// @brief validation results
+static unsigned long validations = 0;                  ///< number of 'v' commands executed
+static unsigned long val_errors = 0;                   ///< total number of errors found
+
+/// @brief replay all operations of trace @a t
+/// @param t mapped trace
+/// @param slot slot array (t->hdr->nslots entries, initially NULL)
+/// @param check correctness mode: warn about invalid operations
+/// @param validate validation mode for 'v' (val_Off, val_Full, val_Incremental)
+static void replay(const Trace *t, void **slot, int check, int validate)
+{
+  const TraceRecord *r = t->ops, *end = t->ops + t->hdr->nops;
+
+  for (; r < end; r++) {
+    void **s = &slot[r->slot];
+
+    switch (r->op) {
+      case op_Malloc:
+        if (check && (*s != NULL)) printf("Warning: overwriting block with id %u.\n", r->slot);
+        *s = mm_malloc(r->size);
+        break;
+
+      case op_Calloc:
+        if (check && (*s != NULL)) printf("Warning: overwriting block with id %u.\n", r->slot);
+        *s = mm_calloc(r->nelem, r->size);
+        break;
+
+      case op_Realloc:
+        *s = mm_realloc(*s, r->size);
+        break;
+
+      case op_Free:
+        if (*s != NULL) {
+          mm_free(*s);
+          *s = NULL;
+        } else if (check) {
+          printf("Warning: double-free detected.\n");
+        }
+        break;
+
+      case op_Validate:
+        if (validate != val_Off) {
+          int errors = mm_validate(validate);
+          if (check && (errors > 0)) {
+            printf("Warning: %d heap errors after operation %lu.\n", errors, r - t->ops);
+          }
+          validations++;
+          val_errors += errors;
+        }
+        break;
+    }
+  }
+}
+
+
+/// @brief print replay and allocator statistics in the format of the mm_driver 'stat' command
+/// @param st allocator statistics
+/// @param time replay time
+static void print_stat(const struct mm_stats *st, const struct timespec *time)
+{
+  unsigned long actions = st->malloc + st->calloc + st->realloc + st->free;
+  double sec = time->tv_sec + time->tv_nsec/1e9;
+
+  printf("--------------------------------------------\n"
+         "Statistics:\n"
+         "  actions:          %6lu\n"
+         "    malloc:         %6lu\n"
+         "    calloc:         %6lu\n"
+         "    realloc:        %6lu\n"
+         "    free:           %6lu\n",
+         actions, st->malloc, st->calloc, st->realloc, st->free);
+  if (st->failed > 0) {
+    printf("    failed:         %6lu\n", st->failed);
+  }
+  printf("  time:             %lu.%09lu sec\n"
+         "  performance:      %.2f kops/sec\n",
+         (unsigned long)time->tv_sec, (unsigned long)time->tv_nsec,
+         sec > 0 ? actions / sec / 1000.0 : 0.0);
+
+  printf("  heap (%s):\n"
+         "    size:           %10lu bytes (peak: %lu bytes)\n"
+         "    expanded:       %10lu times\n"
+         "    in use:         %10lu bytes\n"
+         "    free:           %10lu bytes in %lu blocks\n"
+         "    largest free:   %10lu bytes\n"
+         "    fragmentation:  %10.2f %%\n",
+         bt_policy_name(st->policy),
+         st->heap_size, st->peak_heap_size, st->expand_heap, st->in_use,
+         st->free_bytes, st->free_blocks, st->largest_free, st->fragmentation * 100.0);
+
+  printf("  block search:\n"
+         "    searches:       %10lu\n"
+         "    examined:       %10lu blocks (avg: %.2f)\n",
+         st->searches, st->examined,
+         st->searches > 0 ? (double)st->examined / st->searches : 0.0);
+  if (st->policy == ap_Adaptive) {
+    printf("  adaptive policy:\n"
+           "    active:         %10s\n"
+           "    switches:       %10lu\n",
+           bt_policy_name(st->active), st->switches);
+    unsigned long first = st->switches > MM_SWITCH_LOG ? st->switches - MM_SWITCH_LOG : 0;
+    for (unsigned long i = first; i < st->switches; i++) {
+      const typeof(st->switch_log[0]) *sw = &st->switch_log[i % MM_SWITCH_LOG];
+      printf("    search %8lu: to %-8s (%.1f blocks/search, utilization %.2f)\n",
+             sw->search, bt_policy_name(sw->to), sw->avg_examined, sw->utilization);
+    }
+  }
+  for (int b = 0; b < MM_SEARCH_BUCKETS; b++) {
+    if (st->search_hist[b] == 0) continue;
+
+    unsigned long lo = b == 0 ? 0 : 1UL << b;
+    if (b == MM_SEARCH_BUCKETS-1) {
+      printf("    %7lu -        : %10lu\n", lo, st->search_hist[b]);
+    } else {
+      printf("    %7lu - %7lu: %10lu\n", lo, (2UL << b) - 1, st->search_hist[b]);
+    }
+  }
+  printf("--------------------------------------------\n");
+}
+
+
+/// @brief print program syntax and exit
+/// @param argv0 program name
+static void syntax(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-p <policy>] [-a <budgets>] [-m <mode>] [-d <size>] [-l <level>]\n"
+                  "       [-t <events>] [-V <validation>] <trace.bin>\n"
+                  "Replay a binary trace (see dmas2bin) on the dynamic memory manager.\n"
+                  "\n"
+                  "Options:\n"
+                  " -p <policy>  override allocation policy (firstfit, nextfit, bestfit, adaptive)\n"
+                  " -a <budgets> budgets of the adaptive policy: <window>,<max_examined>,<min_util>\n"
+                  "              (default: 256,64,0.7)\n"
+                  " -m <mode>    override execution mode (correctness, performance)\n"
+                  " -d <size>    override data segment size\n"
+                  " -l <level>   set log level of memory manager\n"
+                  " -t <events>  write event trace to file <events> (memory manager must be built\n"
+                  "              with EVTRACE=1 or 2; decode with evdecode)\n"
+                  " -V <validation> heap validation on 'v': full, incremental, off\n"
+                  "              (default: full in correctness, incremental in performance mode)\n",
+                  basename((char*)argv0));
+
+  exit(EXIT_FAILURE);
+}
+
+
+/// @brief program entry point
+int main(int argc, char *argv[])
+{
+  const char *fn = NULL, *evfn = NULL;
+  int policy = -1, mode = -1, loglevel = 0, validate = -2;
+  size_t dataseg = 0;
+
+  //
+  // parse arguments
+  //
+  for (int i = 1; i < argc; i++) {
+    if ((argv[i][0] == '-') && (argv[i][1] != '\0') && (argv[i][2] == '\0')) {
+      if (i+1 >= argc) syntax(argv[0]);
+      const char *arg = argv[++i];
+
+      switch (argv[i-1][1]) {
+        case 'p': if ((policy = bt_policy_parse(arg)) < 0) syntax(argv[0]); break;
+        case 'm':
+          if      (strcmp(arg, "correctness") == 0) mode = bm_Correctness;
+          else if (strcmp(arg, "performance") == 0) mode = bm_Performance;
+          else syntax(argv[0]);
+          break;
+        case 'd': dataseg = strtoul(arg, NULL, 0); break;
+        case 'l': loglevel = atoi(arg); break;
+        case 't': evfn = arg; break;
+        case 'V':
+          if      (strcmp(arg, "full") == 0)        validate = val_Full;
+          else if (strcmp(arg, "incremental") == 0) validate = val_Incremental;
+          else if (strcmp(arg, "off") == 0)         validate = val_Off;
+          else syntax(argv[0]);
+          break;
+        case 'a': {
+          unsigned long window;
+          double max_examined, min_util;
+          if (sscanf(arg, "%lu,%lf,%lf", &window, &max_examined, &min_util) != 3) syntax(argv[0]);
+          mm_setadaptive(window, max_examined, min_util);
+          break;
+        }
+        default:  syntax(argv[0]);
+      }
+    } else if (fn == NULL) {
+      fn = argv[i];
+    } else {
+      syntax(argv[0]);
+    }
+  }
+
+  if (fn == NULL) syntax(argv[0]);
+
+  //
+  // map trace and apply overrides
+  //
+  Trace t;
+  if (bt_open(fn, &t) != 0) {
+    fprintf(stderr, "ERROR: cannot open trace '%s': %s.\n", fn, strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  if (policy < 0)   policy  = t.hdr->policy;
+  if (mode < 0)     mode    = t.hdr->mode;
+  if (dataseg == 0) dataseg = t.hdr->dataseg;
+  if (validate < val_Off) validate = mode == bm_Correctness ? val_Full : val_Incremental;
+
+  void **slot = calloc(t.hdr->nslots ? t.hdr->nslots : 1, sizeof(void*));
+  if (slot == NULL) {
+    fprintf(stderr, "ERROR: cannot allocate %lu slots.\n", (unsigned long)t.hdr->nslots);
+    return EXIT_FAILURE;
+  }
+
+  //
+  // initialize heap & replay
+  //
+  struct mm_stats st;
+  struct timespec start, stop, time;
+
+  ds_allocate(dataseg);
+  mm_init(policy);
+  mm_setloglevel(loglevel);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  replay(&t, slot, mode == bm_Correctness, validate);
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  time.tv_sec  = stop.tv_sec - start.tv_sec;
+  time.tv_nsec = stop.tv_nsec - start.tv_nsec;
+  if (time.tv_nsec < 0) {
+    time.tv_nsec += 1000000000;
+    time.tv_sec--;
+  }
+
+  mm_stats(&st);
+  print_stat(&st, &time);
+  if (validations > 0) {
+    printf("Validation (%s): %lu errors in %lu checks.\n",
+           validate == val_Full ? "full" : "incremental", val_errors, validations);
+  }
+
+  if ((evfn != NULL) && (evt_dump(evfn) != 0)) {
+    fprintf(stderr, "ERROR: cannot write event trace '%s': %s.\n", evfn, strerror(errno));
+  }
+
+  //
+  // cleanup
+  //
+  ds_release();
+  free(slot);
+  bt_close(&t);
+
+  return EXIT_SUCCESS;
+}
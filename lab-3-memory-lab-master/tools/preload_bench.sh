@@ -0,0 +1,123 @@
+#!/bin/bash
+#---------------------------------------------------------------------------------------------------
+# Lab 3: Memory Lab                       Fall 2020                               System Programming
+#
+# run real programs on libmemmgr.so and compare the allocation policies against the C library
+#
+#   - dirtree (I/O lab) listing a large, generated directory tree
+#   - mcdonalds (network lab) serving several rounds of concurrent clients
+#
+# Usage: preload_bench.sh [-d <dirs>] [-f <files per dir>] [-r <rounds>] [-c <clients>] [-k]
+#
+# Author: Woorim Shin
+#
+
+LAB3=$(cd ${0%/*}/.. && pwd)
+LAB2=$LAB3/../lab-2-io-lab-master
+LAB6=$LAB3/../lab-6-network-lab-master
+LIB=$LAB3/libmemmgr.so
+
+DIRS=200
+FILES=100
+ROUNDS=2
+CLIENTS=20
+KEEP=
+
+CONFIGS="glibc firstfit nextfit bestfit adaptive"
+
+while getopts "d:f:r:c:k" opt; do
+  case $opt in
+    d) DIRS=$OPTARG ;;
+    f) FILES=$OPTARG ;;
+    r) ROUNDS=$OPTARG ;;
+    c) CLIENTS=$OPTARG ;;
+    k) KEEP=1 ;;
+    *) echo "Usage: $0 [-d <dirs>] [-f <files per dir>] [-r <rounds>] [-c <clients>] [-k]"
+       exit 1 ;;
+  esac
+done
+
+# run "$@" with the allocator of configuration $CFG
+function run() {
+  if [[ $CFG == glibc ]]; then
+    "$@"
+  else
+    LD_PRELOAD=$LIB MEMMGR_POLICY=$CFG "$@"
+  fi
+}
+
+# print elapsed time since $T0
+function elapsed() {
+  awk -v t0=$T0 -v t1=$EPOCHREALTIME 'BEGIN { printf "%.3f", t1-t0 }'
+}
+
+# print maximum resident set size of process $1 in KB
+function maxrss() {
+  awk '/VmHWM/ { print $2 }' /proc/$1/status
+}
+
+
+#
+# build
+#
+make -s -C $LAB3 libmemmgr.so || exit 1
+make -s -C $LAB2 || exit 1
+make -s -C $LAB6 || exit 1
+
+
+#
+# dirtree
+#
+TREE=$(mktemp -d /tmp/preload_bench.XXXXXX)
+echo "Generating $DIRS directories with $FILES files each in '$TREE'..."
+for ((d=0; d<$DIRS; d++)); do
+  dir=$TREE/d$((d % 10))/d$((d / 10 % 10))/dir$d
+  mkdir -p $dir
+  (cd $dir && eval touch f{1..$FILES})
+done
+
+echo
+echo "dirtree -v -s $TREE/"
+printf "  %-10s %12s %12s\n" "allocator" "time [s]" "max RSS [KB]"
+for CFG in $CONFIGS; do
+  T0=$EPOCHREALTIME
+  run $LAB2/dirtree -v -s $TREE/ > /dev/null &
+  PID=$!
+  # sample the peak RSS while dirtree is running
+  while RSS=$(maxrss $PID 2>/dev/null) && [[ -n "$RSS" ]]; do
+    PEAK=$RSS; sleep 0.01
+  done
+  wait $PID
+  T=$(elapsed)
+  printf "  %-10s %12s %12s\n" $CFG $T $PEAK
+done
+
+[[ -z "$KEEP" ]] && rm -rf $TREE
+
+
+#
+# mcdonalds
+#
+echo
+echo "mcdonalds: $ROUNDS rounds of $CLIENTS concurrent clients"
+printf "  %-10s %12s %12s\n" "allocator" "time [s]" "max RSS [KB]"
+for CFG in $CONFIGS; do
+  (cd $LAB6 && run ./mcdonalds > /dev/null) &
+  sleep 1
+  SERVER=$(pgrep -n -x mcdonalds)
+
+  T0=$EPOCHREALTIME
+  for ((r=0; r<$ROUNDS; r++)); do
+    run $LAB6/client $CLIENTS > /dev/null
+  done
+  T=$(elapsed)
+  RSS=$(maxrss $SERVER)
+
+  # the server closes after the second SIGINT
+  kill -INT $SERVER; sleep 0.2; kill -INT $SERVER
+  wait
+
+  printf "  %-10s %12s %12s\n" $CFG $T $RSS
+done
+
+exit 0
@@ -0,0 +1,75 @@
+#!/bin/bash
+#---------------------------------------------------------------------------------------------------
+# Lab 3: Memory Lab                       Fall 2020                               System Programming
+#
+# compare the compile-time specialized builds of the memory manager (make variants) side by side
+#
+#   every mm_replay-<policy>-<bs> variant and the default build (policy selected at runtime,
+#   BS=32) replay the same traces; the best of several runs is reported per variant
+#
+# Usage: variant_bench.sh [-r <runs>] [<trace.bin|trace.dmas> ...]   (default: tests/*.dmas)
+#
+# Author: Woorim Shin
+#
+
+LAB3=$(cd ${0%/*}/.. && pwd)
+
+RUNS=3
+
+while getopts "r:" opt; do
+  case $opt in
+    r) RUNS=$OPTARG ;;
+    *) echo "Usage: $0 [-r <runs>] [<trace.bin|trace.dmas> ...]"
+       exit 1 ;;
+  esac
+done
+shift $((OPTIND-1))
+
+TRACES=("$@")
+if [[ ${#TRACES[@]} -eq 0 ]]; then TRACES=($LAB3/tests/*.dmas); fi
+
+
+#
+# build
+#
+make -s -C $LAB3 mm_replay dmas2bin variants || exit 1
+
+TMP=$(mktemp -d /tmp/variant_bench.XXXXXX)
+trap "rm -rf $TMP" EXIT
+
+
+# replay trace $1 with "${@:2}" $RUNS times and print "<kops/sec> <peak heap> <frag> <avg examined>"
+# of the fastest run
+function bench() {
+  local trace=$1; shift
+  for ((r=0; r<$RUNS; r++)); do
+    "$@" -m performance -V off $trace | awk '
+      /performance:/   { kops = $2 }
+      /size:.*peak:/   { peak = $5 }
+      /fragmentation:/ { frag = $2 }
+      /examined:/      { sub(/\)/, "", $5); avg = $5 }
+      END              { print kops, peak, frag, avg }'
+  done | sort -k1,1nr | head -1
+}
+
+
+for trace in "${TRACES[@]}"; do
+  if [[ $trace == *.dmas ]]; then
+    bin=$TMP/$(basename ${trace%.dmas}).bin
+    $LAB3/dmas2bin $trace $bin > /dev/null 2>&1 || exit 1
+  else
+    bin=$trace
+  fi
+
+  echo
+  echo "$trace (best of $RUNS runs)"
+  printf "  %-24s %12s %12s %8s %10s\n" "variant" "kops/sec" "peak heap" "frag %" "examined"
+
+  for policy in firstfit nextfit bestfit adaptive; do
+    printf "  %-24s %12s %12s %8s %10s\n" "mm_replay -p $policy" \
+           $(bench $bin $LAB3/mm_replay -p $policy)
+    for v in $(cd $LAB3 && ls mm_replay-$policy-* | sort -t- -k3,3n); do
+      printf "  %-24s %12s %12s %8s %10s\n" $v $(bench $bin $LAB3/$v)
+    done
+  done
+done